@@ -4,7 +4,10 @@
 // License:     The Code Project Open License (CPOL)
 //              https://www.codeproject.com/info/cpol10.aspx
 
+#include <bitset>
+#include <cstring>
 #include <string>
+#include <vector>
 
 namespace utils
 {
@@ -186,4 +189,360 @@ bool gitignore_glob_match(const std::string& text, const std::string& glob)
 	return j >= m;
 }
 
+// gitignore-style glob pattern compiled once to be matched against many texts, with the same results as
+// gitignore_glob_match. The literal runs of the pattern reject most texts with plain string comparisons and searches.
+// Patterns without ** are then matched path component by path component: *, ? and [] never match a /, so that within
+// a component each run between two stars is placed at its leftmost occurrence, without backtracking. Patterns with **
+// go through gitignore_glob_match once their literal prefix matches.
+class GlobMatcher
+{
+public:
+	explicit GlobMatcher(const std::string& glob) : glob_{glob}
+	{
+		const size_t m = glob.size();
+		size_t j = 0;
+
+		// same choice of the part of the text to match as gitignore_glob_match
+		if (j + 1 < m && glob[j] == '/')
+		{
+			rooted_ = true;
+			j++;
+		}
+		else if (glob.find('/') == std::string::npos)
+		{
+			basename_ = true;
+		}
+
+		std::vector<Token> tokens;
+		while (j < m)
+		{
+			Token token;
+			switch (glob[j])
+			{
+			case '*':
+				if (j + 1 < m && glob[j + 1] == '*')
+				{
+					has_double_star_ = true;
+					break;
+				}
+				token.kind_ = kStar;
+				j++;
+				break;
+			case '?':
+				token.kind_ = kAnyChar;
+				j++;
+				break;
+			case '[':
+				token.kind_ = kClass;
+				j = ParseClass(glob, j, token.members_);
+				break;
+			case '\\':
+				// literal match \-escaped character
+				if (j + 1 < m)
+				{
+					j++;
+				}
+				// FALLTHROUGH
+			default:
+				token.kind_ = kLiteral;
+				token.char_ = glob[j];
+				j++;
+				break;
+			}
+			if (has_double_star_)
+			{
+				break;
+			}
+			tokens.push_back(token);
+		}
+
+		// literal runs, the first and last ones anchored at the ends of the text
+		size_t first_special = 0;
+		while (first_special < tokens.size() && tokens[first_special].kind_ == kLiteral)
+		{
+			prefix_.push_back(tokens[first_special++].char_);
+		}
+		if (has_double_star_)
+		{
+			// the tokens end at the first **, only the prefix is known to be required
+			return;
+		}
+		exact_ = first_special == tokens.size();
+		if (exact_)
+		{
+			return;
+		}
+		size_t last_special = tokens.size() - 1;
+		while (tokens[last_special].kind_ == kLiteral)
+		{
+			last_special--;
+		}
+		for (size_t k = last_special + 1; k < tokens.size(); k++)
+		{
+			suffix_.push_back(tokens[k].char_);
+		}
+		std::string run;
+		for (size_t k = first_special; k <= last_special; k++)
+		{
+			if (tokens[k].kind_ == kLiteral)
+			{
+				run.push_back(tokens[k].char_);
+			}
+			else if (!run.empty())
+			{
+				middle_runs_.push_back(run);
+				run.clear();
+			}
+		}
+
+		// the components of the pattern, split in chunks by the stars
+		components_.emplace_back();
+		components_.back().chunks_.emplace_back();
+		for (const Token& token : tokens)
+		{
+			if (token.kind_ == kStar)
+			{
+				components_.back().chunks_.emplace_back();
+				continue;
+			}
+			min_length_++;
+			if (token.kind_ == kLiteral && token.char_ == '/')
+			{
+				components_.emplace_back();
+				components_.back().chunks_.emplace_back();
+				continue;
+			}
+			Chunk& chunk = components_.back().chunks_.back();
+			chunk.tokens_.push_back(token);
+			if (token.kind_ == kLiteral)
+			{
+				chunk.literal_.push_back(token.char_);
+			}
+			else
+			{
+				chunk.literal_only_ = false;
+			}
+		}
+	}
+
+	bool Match(const std::string& text) const
+	{
+		const size_t n = text.size();
+		size_t i = 0;
+		if (rooted_)
+		{
+			// if pathname starts with ./ then ignore these pairs, then a leading /
+			while (i + 1 < n && text[i] == '.' && text[i + 1] == '/')
+			{
+				i += 2;
+			}
+			if (i < n && text[i] == '/')
+			{
+				i++;
+			}
+		}
+		else if (basename_)
+		{
+			const size_t sep = text.rfind('/');
+			if (sep != std::string::npos)
+			{
+				i = sep + 1;
+			}
+		}
+
+		const size_t length = n - i;
+		if (length < prefix_.size() || std::memcmp(text.data() + i, prefix_.data(), prefix_.size()) != 0)
+		{
+			return false;
+		}
+		if (has_double_star_)
+		{
+			return gitignore_glob_match(text, glob_);
+		}
+		if (exact_)
+		{
+			return length == prefix_.size();
+		}
+		if (length < min_length_ ||
+		    std::memcmp(text.data() + n - suffix_.size(), suffix_.data(), suffix_.size()) != 0)
+		{
+			return false;
+		}
+		size_t pos = i + prefix_.size();
+		const size_t limit = n - suffix_.size();
+		for (const std::string& run : middle_runs_)
+		{
+			pos = text.find(run, pos);
+			if (pos == std::string::npos || pos + run.size() > limit)
+			{
+				return false;
+			}
+			pos += run.size();
+		}
+
+		size_t start = i;
+		for (size_t c = 0; c < components_.size(); c++)
+		{
+			size_t end = text.find('/', start);
+			if (c + 1 == components_.size())
+			{
+				if (end != std::string::npos)
+				{
+					return false;
+				}
+				end = n;
+			}
+			else if (end == std::string::npos)
+			{
+				return false;
+			}
+			if (!MatchComponent(components_[c], text, start, end))
+			{
+				return false;
+			}
+			start = end + 1;
+		}
+		return true;
+	}
+
+private:
+	enum TokenKind
+	{
+		kLiteral,
+		kAnyChar,
+		kClass,
+		kStar
+	};
+
+	struct Token
+	{
+		TokenKind kind_{kLiteral};
+		char char_{0};
+		std::bitset<256> members_;
+	};
+
+	// Tokens matching one character each, between two stars
+	struct Chunk
+	{
+		std::vector<Token> tokens_;
+		std::string literal_;
+		bool literal_only_{true};
+	};
+
+	// Text between two /, the chunks are separated by stars
+	struct Component
+	{
+		std::vector<Chunk> chunks_;
+	};
+
+	// Characters matched by the class starting at j, as gitignore_glob_match reads it. Returns the position after it.
+	static size_t ParseClass(const std::string& glob, size_t j, std::bitset<256>& members)
+	{
+		const size_t m = glob.size();
+		const bool reverse = j + 1 < m && (glob[j + 1] == '^' || glob[j + 1] == '!');
+		if (reverse)
+		{
+			j++;
+		}
+		size_t end = j;
+		for (int c = 0; c < 256; c++)
+		{
+			const char text_i = static_cast<char>(c);
+			bool matched = false;
+			size_t k = j;
+			for (int lastchr = 256; ++k < m && glob[k] != ']'; lastchr = static_cast<int>(glob[k]))
+			{
+				if ((lastchr < 256) && (glob[k] == '-') && (k + 1 < m) && (glob[k + 1] != ']')
+					? text_i <= glob[++k] && static_cast<int>(text_i) >= lastchr
+					: text_i == glob[k])
+				{
+					matched = true;
+				}
+			}
+			members[static_cast<size_t>(c)] = matched != reverse && text_i != '/';
+			end = k;
+		}
+		return end < m ? end + 1 : end;
+	}
+
+	static bool MatchChunkAt(const Chunk& chunk, const std::string& text, size_t pos)
+	{
+		if (chunk.literal_only_)
+		{
+			return std::memcmp(text.data() + pos, chunk.literal_.data(), chunk.literal_.size()) == 0;
+		}
+		for (const Token& token : chunk.tokens_)
+		{
+			const char text_i = text[pos++];
+			if ((token.kind_ == kLiteral && token.char_ != text_i) ||
+			    (token.kind_ == kClass && !token.members_[static_cast<unsigned char>(text_i)]))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Leftmost position of the chunk in [pos, limit), npos if none
+	static size_t FindChunk(const Chunk& chunk, const std::string& text, size_t pos, size_t limit)
+	{
+		const size_t size = chunk.tokens_.size();
+		if (chunk.literal_only_)
+		{
+			const size_t found = text.find(chunk.literal_, pos);
+			return found != std::string::npos && found + size <= limit ? found : std::string::npos;
+		}
+		for (; pos + size <= limit; pos++)
+		{
+			if (MatchChunkAt(chunk, text, pos))
+			{
+				return pos;
+			}
+		}
+		return std::string::npos;
+	}
+
+	static bool MatchComponent(const Component& component, const std::string& text, size_t begin, size_t end)
+	{
+		const auto& chunks = component.chunks_;
+		const size_t length = end - begin;
+		const Chunk& first = chunks.front();
+		if (chunks.size() == 1)
+		{
+			return length == first.tokens_.size() && MatchChunkAt(first, text, begin);
+		}
+
+		// the first chunk starts the component, the last one ends it, the others are placed leftmost in between
+		const Chunk& last = chunks.back();
+		if (length < first.tokens_.size() + last.tokens_.size() || !MatchChunkAt(first, text, begin) ||
+		    !MatchChunkAt(last, text, end - last.tokens_.size()))
+		{
+			return false;
+		}
+		size_t pos = begin + first.tokens_.size();
+		const size_t limit = end - last.tokens_.size();
+		for (size_t c = 1; c + 1 < chunks.size(); c++)
+		{
+			pos = FindChunk(chunks[c], text, pos, limit);
+			if (pos == std::string::npos)
+			{
+				return false;
+			}
+			pos += chunks[c].tokens_.size();
+		}
+		return true;
+	}
+
+	std::string glob_;
+	bool rooted_{false};
+	bool basename_{false};
+	bool has_double_star_{false};
+	bool exact_{false};
+	std::string prefix_;
+	std::string suffix_;
+	std::vector<std::string> middle_runs_;
+	size_t min_length_{0};
+	std::vector<Component> components_;
+};
+
 } // namespace utils
\ No newline at end of file
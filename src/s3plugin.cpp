@@ -12,13 +12,17 @@
 #include <aws/core/Aws.h>
 #include <aws/core/auth/AWSCredentials.h>
 #include <aws/core/auth/AWSCredentialsProvider.h>
+#include <aws/core/http/HttpResponse.h>
+#include <aws/core/utils/HashingUtils.h>
 #include <aws/core/utils/stream/PreallocatedStreamBuf.h>
+#include <aws/core/utils/threading/Executor.h>
 #include <aws/s3/S3Client.h>
 #include <aws/s3/model/AbortMultipartUploadRequest.h>
 #include <aws/s3/model/CompleteMultipartUploadRequest.h>
 #include <aws/s3/model/CreateMultipartUploadRequest.h>
 #include <aws/s3/model/DeleteObjectRequest.h>
 #include <aws/s3/model/GetObjectRequest.h>
+#include <aws/s3/model/HeadBucketRequest.h>
 #include <aws/s3/model/HeadObjectRequest.h>
 #include <aws/s3/model/ListObjectsV2Request.h>
 #include <aws/s3/model/PutObjectRequest.h>
@@ -27,17 +31,36 @@
 
 #include <algorithm>
 #include <assert.h>
+#include <atomic>
+#include <cerrno>
+#include <climits>
 #include <cstdio>
 #include <cstdlib>
 #include <fstream>
+#include <future>
+#include <iomanip>
 #include <iostream>
 #include <limits>
 #include <memory>
 #include <sstream>
 #include <string>
+#include <type_traits>
 #include <aws/core/utils/logging/DefaultLogSystem.h>
 #include <aws/core/utils/logging/ConsoleLogSystem.h>
 
+#ifdef __unix_or_mac__
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+#else
+#include <direct.h>
+#include <io.h>
+#include <process.h>
+#include <sys/stat.h>
+#include <sys/utime.h>
+#endif
+
 using namespace Aws::Utils::Logging;
 using namespace s3plugin;
 
@@ -47,6 +70,11 @@ int bIsConnected = false;
 
 constexpr const char* KHIOPS_S3 = "KHIOPS_S3";
 
+// User metadata describing the first line of the objects written by the driver
+constexpr const char* kHeaderLengthMetadata = "khiops-header-length";
+constexpr const char* kHeaderHashMetadata = "khiops-header-sha256";
+using Metadata = Aws::Map<Aws::String, Aws::String>;
+
 Aws::SDKOptions options;
 Aws::UniquePtr<Aws::S3::S3Client> client;
 
@@ -55,11 +83,66 @@ Aws::String globalBucketName = "";
 
 HandleContainer<ReaderPtr> active_reader_handles;
 HandleContainer<WriterPtr> active_writer_handles;
+std::mutex handles_mutex; // the containers only: driver_pread looks handles up from any thread
+
+// Background requests (read-ahead...) run on a pool owned by the driver
+using Executor = Aws::Utils::Threading::PooledThreadExecutor;
+constexpr size_t kDefaultParallelRequests{8};
+Aws::UniquePtr<Executor> executor;
+std::mutex executor_mutex; // tasks are also submitted from the background header checks
+size_t executor_pool_size = kDefaultParallelRequests;
+
+ReadConfig read_config;
+BlockCache block_cache{read_config.cache_size_};
+DiskCacheIndex disk_cache_index;
+
+// Object metadata, listings and multifile header lengths, the latter keyed by the versions of the parts
+TtlCache<Aws::S3::Model::HeadObjectOutcome> head_cache;
+TtlCache<ObjectListPtr> list_cache;
+TtlCache<tOffset> header_length_cache;
+LayoutRegistry layout_registry;
+
+// Requests in flight, shared with the identical requests made meanwhile
+SingleFlight<Aws::S3::Model::HeadObjectOutcome> head_flights;
+SingleFlight<SimpleOutcome<ObjectListPtr>> list_flights;
+SingleFlight<SimpleOutcome<FirstBlock>> first_block_flights;
+SingleFlight<SimpleOutcome<DownloadedRun>> block_run_flights;
+
+// Hedged GETs: time to the first response of the recent requests
+LatencyTracker first_byte_latency;
+
+// Reads started by driver_freadAsync, by token
+std::mutex pending_reads_mutex;
+Aws::Map<long long, PendingRead> pending_reads;
+long long next_read_token{1};
+
+// Streaming GETs each hold a connection and a thread for as long as their reader scans the part
+std::atomic<size_t> open_streams{0};
 
 Aws::String last_error;
+std::mutex last_error_mutex;
 
 constexpr const char* nullptr_msg_stub = "Error passing null pointer to ";
 
+// The downloads of the asynchronous reads of a stream, or of all streams if it is null, end before it is closed.
+// Their tokens remain valid.
+void WaitPendingReads(const void* stream)
+{
+	std::lock_guard<std::mutex> lock(pending_reads_mutex);
+	for (auto& pending : pending_reads)
+	{
+		if (stream == nullptr || pending.second.stream_ == stream)
+		{
+			for (auto& piece : pending.second.pieces_)
+			{
+				piece.wait();
+			}
+		}
+	}
+}
+
+void ConfigureDiskCache();
+
 // test utilities
 
 void test_setClient(Aws::UniquePtr<Aws::S3::S3Client>&& mock_client_ptr)
@@ -76,14 +159,46 @@ void test_unsetClient()
 
 void test_clearHandles()
 {
+	WaitPendingReads(nullptr);
+	pending_reads.clear();
+	std::lock_guard<std::mutex> lock(handles_mutex);
 	active_reader_handles.clear();
 	active_writer_handles.clear();
 }
 
+void ConfigureMetadataCaches()
+{
+	const std::chrono::milliseconds ttl{read_config.metadata_ttl_ms_};
+	head_cache.SetTtl(ttl);
+	list_cache.SetTtl(ttl);
+	header_length_cache.SetTtl(ttl);
+}
+
 void test_cleanupClient()
 {
 	test_clearHandles();
+	executor.reset();
+	first_byte_latency.Clear();
+	layout_registry.Clear();
 	test_unsetClient();
+	read_config = ReadConfig{};
+	block_cache.Clear();
+	block_cache.SetBudget(read_config.cache_size_);
+	ConfigureMetadataCaches();
+}
+
+void test_setReadConfig(const ReadConfig& config)
+{
+	read_config = config;
+	block_cache.Clear();
+	block_cache.SetBudget(read_config.cache_size_);
+	ConfigureMetadataCaches();
+	ConfigureDiskCache();
+}
+
+size_t test_getDiskCacheUsage()
+{
+	return disk_cache_index.GetUsage();
 }
 
 void* test_getActiveReaderHandles()
@@ -113,13 +228,12 @@ void* test_getActiveWriterHandles()
 	}
 
 #define FIND_HANDLE_OR_ERROR(container, stream, errval)                                                                \
-	auto stream##_it = FindHandle((container), (stream));                                                          \
-	if (stream##_it == container.end())                                                                            \
+	auto* h_ptr = LookupHandle((container), (stream));                                                             \
+	if (h_ptr == nullptr)                                                                                          \
 	{                                                                                                              \
 		LogError("Cannot identify stream");                                                                    \
 		return (errval);                                                                                       \
-	}                                                                                                              \
-	auto& h_ptr = *stream##_it;
+	}
 
 #define IF_ERROR(outcome) if (!(outcome).IsSuccess())
 
@@ -154,6 +268,7 @@ void* test_getActiveWriterHandles()
 void LogError(const Aws::String& msg)
 {
 	spdlog::error(msg);
+	std::lock_guard<std::mutex> lock(last_error_mutex);
 	last_error = std::move(msg);
 }
 
@@ -193,9 +308,309 @@ Aws::S3::Model::GetObjectOutcome GetObject(const Aws::String& bucket, const Aws:
 	return client->GetObject(MakeGetObjectRequest(bucket, object, std::move(range)));
 }
 
+Aws::String MakeMetadataCacheKey(const Aws::String& bucket, const Aws::String& object)
+{
+	Aws::String key{bucket};
+	key.push_back('\0');
+	key.append(object);
+	return key;
+}
+
+bool IsNotFoundError(const Aws::S3::S3Error& error)
+{
+	return error.GetErrorType() == Aws::S3::S3Errors::NO_SUCH_KEY ||
+	       error.GetErrorType() == Aws::S3::S3Errors::RESOURCE_NOT_FOUND;
+}
+
+// Successes and missing objects are cached, other errors may be transient
 Aws::S3::Model::HeadObjectOutcome HeadObject(const Aws::String& bucket, const Aws::String& object)
 {
-	return client->HeadObject(MakeHeadObjectRequest(bucket, object));
+	const Aws::String cache_key = MakeMetadataCacheKey(bucket, object);
+	Aws::S3::Model::HeadObjectOutcome outcome;
+	if (head_cache.Lookup(cache_key, outcome))
+	{
+		return outcome;
+	}
+
+	return head_flights.Do(cache_key,
+			       [&]()
+			       {
+				       auto head_outcome = client->HeadObject(MakeHeadObjectRequest(bucket, object));
+				       if (head_outcome.IsSuccess() || IsNotFoundError(head_outcome.GetError()))
+				       {
+					       head_cache.Insert(cache_key, head_outcome);
+				       }
+				       return head_outcome;
+			       });
+}
+
+// Forget what is known of an object after the driver modified it. Any listing may include the object.
+void InvalidateMetadata(const Aws::String& bucket, const Aws::String& object)
+{
+	head_cache.Erase(MakeMetadataCacheKey(bucket, object));
+	list_cache.Clear();
+}
+
+Executor& GetExecutor()
+{
+	std::lock_guard<std::mutex> lock(executor_mutex);
+	if (!executor)
+	{
+		executor = Aws::MakeUnique<Executor>(KHIOPS_S3, executor_pool_size);
+	}
+	return *executor;
+}
+
+// Set in the threads of the driver's pool
+thread_local bool on_executor_thread{false};
+
+// Run a function on the driver's pool, its result is delivered through the future
+template <typename Func> std::future<typename std::result_of<Func()>::type> SubmitTask(Func&& func)
+{
+	using Result = typename std::result_of<Func()>::type;
+	auto task = Aws::MakeShared<std::packaged_task<Result()>>(KHIOPS_S3, std::forward<Func>(func));
+	std::future<Result> result = task->get_future();
+	if (!GetExecutor().Submit(
+		[task]()
+		{
+			on_executor_thread = true;
+			(*task)();
+		}))
+	{
+		// the pool refused the task, run it in the calling thread
+		(*task)();
+	}
+	return result;
+}
+
+// FNV-1a, stable across processes and platforms, as 16 hexadecimal digits
+Aws::String HashToHex(const Aws::String& value)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for (const char c : value)
+	{
+		hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ULL;
+	}
+
+	Aws::OStringStream hex;
+	hex << std::hex << std::setw(16) << std::setfill('0') << hash;
+	return hex.str();
+}
+
+// Object list
+
+int HexDigitValue(char c)
+{
+	if (c >= '0' && c <= '9')
+	{
+		return c - '0';
+	}
+	if (c >= 'a' && c <= 'f')
+	{
+		return c - 'a' + 10;
+	}
+	return -1;
+}
+
+void ObjectList::Append(const Aws::String& key, tOffset size, const Aws::String& etag)
+{
+	const size_t index = sizes_.size();
+
+	// the name is stored after the prefix it shares with the previous one
+	size_t shared_length = 0;
+	if (index % restart_interval_ != 0)
+	{
+		const Aws::String previous = GetKey(index - 1);
+		const size_t max_shared = std::min({previous.size(), key.size(),
+						    static_cast<size_t>(std::numeric_limits<unsigned short>::max())});
+		while (shared_length < max_shared && previous[shared_length] == key[shared_length])
+		{
+			shared_length++;
+		}
+	}
+	key_arena_.insert(key_arena_.end(), key.begin() + static_cast<std::ptrdiff_t>(shared_length), key.end());
+	key_ends_.push_back(key_arena_.size());
+	shared_lengths_.push_back(static_cast<unsigned short>(shared_length));
+	sizes_.push_back(size);
+
+	// "<32 lowercase hex digits>", with the quotes
+	unsigned char md5[md5_size_] = {};
+	bool is_md5 = etag.size() == 2 * md5_size_ + 2 && etag.front() == '"' && etag.back() == '"';
+	for (size_t i = 0; is_md5 && i < md5_size_; i++)
+	{
+		const int high = HexDigitValue(etag[1 + 2 * i]);
+		const int low = HexDigitValue(etag[2 + 2 * i]);
+		is_md5 = high >= 0 && low >= 0;
+		md5[i] = static_cast<unsigned char>(high * 16 + low);
+	}
+	md5_etags_.insert(md5_etags_.end(), md5, md5 + md5_size_);
+	if (etag.empty())
+	{
+		etag_kinds_.push_back(kNoEtag);
+	}
+	else if (is_md5)
+	{
+		etag_kinds_.push_back(kMd5Etag);
+	}
+	else
+	{
+		etag_kinds_.push_back(kOtherEtag);
+		other_etags_.emplace(index, etag);
+	}
+}
+
+Aws::String ObjectList::GetKey(size_t i) const
+{
+	const size_t restart = i - i % restart_interval_;
+	Aws::String key;
+	for (size_t j = restart; j <= i; j++)
+	{
+		const size_t begin = j == 0 ? 0 : key_ends_[j - 1];
+		key.resize(shared_lengths_[j]);
+		key.append(key_arena_.data() + begin, key_ends_[j] - begin);
+	}
+	return key;
+}
+
+Aws::String ObjectList::GetETag(size_t i) const
+{
+	switch (etag_kinds_[i])
+	{
+	case kMd5Etag:
+	{
+		static const char hex_digits[] = "0123456789abcdef";
+		Aws::String etag(2 * md5_size_ + 2, '"');
+		for (size_t j = 0; j < md5_size_; j++)
+		{
+			const unsigned char byte = md5_etags_[i * md5_size_ + j];
+			etag[1 + 2 * j] = hex_digits[byte >> 4];
+			etag[2 + 2 * j] = hex_digits[byte & 0xf];
+		}
+		return etag;
+	}
+	case kOtherEtag:
+		return other_etags_.at(i);
+	default:
+		return Aws::String();
+	}
+}
+
+bool ObjectList::operator==(const ObjectList& other) const
+{
+	return sizes_ == other.sizes_ && key_ends_ == other.key_ends_ && shared_lengths_ == other.shared_lengths_ &&
+	       key_arena_ == other.key_arena_ && etag_kinds_ == other.etag_kinds_ && md5_etags_ == other.md5_etags_ &&
+	       other_etags_ == other.other_etags_;
+}
+
+// Block cache
+
+size_t BlockCacheKeyHash::operator()(const BlockCacheKey& key) const
+{
+	const std::hash<Aws::String> string_hash;
+	size_t seed = std::hash<tOffset>{}(key.index_);
+	for (const Aws::String* part : {&key.bucket_, &key.object_, &key.etag_})
+	{
+		seed ^= string_hash(*part) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+	}
+	return seed;
+}
+
+void BlockCache::SetBudget(size_t budget)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	budget_ = budget;
+	EvictOverBudget();
+}
+
+size_t BlockCache::GetBudget() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return budget_;
+}
+
+BlockData BlockCache::Lookup(const BlockCacheKey& key)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	const auto found = index_.find(key);
+	if (found == index_.end())
+	{
+		return nullptr;
+	}
+
+	// a hit makes the block most recently used in the protected segment
+	const auto entry_it = found->second;
+	const size_t size = entry_it->data_->size();
+	if (entry_it->protected_)
+	{
+		protected_.splice(protected_.begin(), protected_, entry_it);
+	}
+	else
+	{
+		entry_it->protected_ = true;
+		protected_.splice(protected_.begin(), probation_, entry_it);
+		probation_size_ -= size;
+		protected_size_ += size;
+		EvictOverBudget();
+	}
+	return entry_it->data_;
+}
+
+bool BlockCache::Contains(const BlockCacheKey& key) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return index_.find(key) != index_.end();
+}
+
+void BlockCache::Insert(const BlockCacheKey& key, BlockData data)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	const size_t size = data->size();
+	if (size > budget_ || index_.find(key) != index_.end())
+	{
+		return;
+	}
+
+	probation_.push_front(Entry{key, std::move(data), false});
+	probation_size_ += size;
+	index_[key] = probation_.begin();
+	EvictOverBudget();
+}
+
+void BlockCache::Clear()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	index_.clear();
+	probation_.clear();
+	protected_.clear();
+	probation_size_ = 0;
+	protected_size_ = 0;
+}
+
+// Called with the lock held
+void BlockCache::EvictOverBudget()
+{
+	// the protected segment keeps at most 80% of the budget, its least recently used blocks get
+	// another chance in the probation segment
+	const size_t protected_budget = budget_ / 5 * 4;
+	while (protected_size_ > protected_budget)
+	{
+		const auto entry_it = std::prev(protected_.end());
+		const size_t size = entry_it->data_->size();
+		entry_it->protected_ = false;
+		probation_.splice(probation_.begin(), protected_, entry_it);
+		protected_size_ -= size;
+		probation_size_ += size;
+	}
+
+	while (probation_size_ + protected_size_ > budget_)
+	{
+		EntryList& victims = probation_.empty() ? protected_ : probation_;
+		const auto entry_it = std::prev(victims.end());
+		const size_t size = entry_it->data_->size();
+		(entry_it->protected_ ? protected_size_ : probation_size_) -= size;
+		index_.erase(entry_it->key_);
+		victims.erase(entry_it);
+	}
 }
 
 template <typename H> HandleIt<H> FindHandle(HandleContainer<H>& container, void* handle)
@@ -210,16 +625,29 @@ template <typename H> void EraseRemove(HandleContainer<H>& container, HandleIt<H
 	container.pop_back();
 }
 
-struct SimpleError
+template <typename H> typename H::element_type* LookupHandle(HandleContainer<H>& container, void* handle)
 {
-	int code_;
-	Aws::String err_msg_;
+	std::lock_guard<std::mutex> lock(handles_mutex);
+	const auto it = FindHandle(container, handle);
+	return it == container.end() ? nullptr : it->get();
+}
 
-	Aws::String GetMessage() const
+// The handle is destroyed out of the lock, since it may wait for its downloads
+template <typename H> bool RemoveHandle(HandleContainer<H>& container, void* handle)
+{
+	H removed;
 	{
-		return std::to_string(code_) + err_msg_;
+		std::lock_guard<std::mutex> lock(handles_mutex);
+		const auto it = FindHandle(container, handle);
+		if (it == container.end())
+		{
+			return false;
+		}
+		removed = std::move(*it);
+		EraseRemove(container, it);
 	}
-};
+	return true;
+}
 
 SimpleError MakeSimpleError(Aws::S3::S3Errors err_code, Aws::String&& err_msg)
 {
@@ -242,13 +670,8 @@ struct ParseUriResult
 	Aws::String object_;
 };
 
-using ObjectsVec = Aws::Vector<S3Object>;
-
-template <typename R> using SimpleOutcome = Aws::Utils::Outcome<R, SimpleError>;
-
 using ParseURIOutcome = SimpleOutcome<ParseUriResult>;
-using SizeOutcome = SimpleOutcome<long long>;
-using FilterOutcome = SimpleOutcome<ObjectsVec>;
+using FilterOutcome = SimpleOutcome<ObjectListPtr>;
 using UploadOutcome = SimpleOutcome<bool>; // R can't be void
 
 // Definition of helper functions
@@ -260,120 +683,1922 @@ Aws::String MakeByteRange(int64_t start, int64_t end)
 }
 
 
-SizeOutcome DownloadFileRangeToVector(const Aws::String& bucket, const Aws::String& object_name, Aws::Vector<unsigned char>& contentVector,
-					std::int64_t start_range, std::int64_t end_range)
+// Memory area receiving a piece of a response body
+struct BufferSegment
 {
-	// Note: AWS byte ranges are inclusive
-	auto request = MakeGetObjectRequest(bucket, object_name, MakeByteRange(start_range, end_range));
-	auto outcome = client->GetObject(request);
-	RETURN_OUTCOME_ON_ERROR(outcome);
+	unsigned char* data_;
+	size_t size_;
+};
+
+// Stream buffer over a sequence of memory segments, filled one after the other. Installed as the
+// response stream of a request, it lets the SDK write the body straight to its final destination.
+// What was written since the resume point can be read back, so that error payloads can still be parsed.
+class SegmentedStreamBuf : public std::streambuf
+{
+public:
+	explicit SegmentedStreamBuf(Aws::Vector<BufferSegment> segments) : segments_{std::move(segments)}
+	{
+		Reset();
+	}
+
+	// back to the resume point, in case the SDK retries the request
+	void Reset()
+	{
+		write_segment_ = resume_segment_;
+		full_segments_size_ = resume_full_segments_size_;
+		read_segment_ = resume_segment_;
+		SetPutArea();
+		pbump(static_cast<int>(resume_offset_));
+		setg(nullptr, nullptr, nullptr);
+		diverted_ = false;
+		diverted_data_.clear();
+		diverted_read_ = 0;
+	}
+
+	// A new response starts. If the previous one wrote past the resume point, this is an SDK retry that would
+	// download these bytes again: the retry is refused and its body diverted, the caller resumes from the first
+	// missing byte instead.
+	void StartResponse()
+	{
+		if (GetWrittenSize() > GetResumePoint())
+		{
+			retry_refused_ = true;
+			Divert();
+			return;
+		}
+		Reset();
+	}
+
+	bool IsRetryRefused() const
+	{
+		return retry_refused_;
+	}
+
+	// The body being received is not the requested range, an error payload for instance: it is kept aside, where
+	// it can be read back, and the segments are left as they are
+	void Divert()
+	{
+		if (!diverted_)
+		{
+			diverted_offset_ = static_cast<size_t>(pptr() - pbase());
+			setp(nullptr, nullptr);
+			diverted_ = true;
+		}
+		setg(nullptr, nullptr, nullptr);
+		diverted_data_.clear();
+		diverted_read_ = 0;
+	}
+
+	// keep what was written so far, a new request continues the body from there
+	void SetResumePoint()
+	{
+		resume_segment_ = write_segment_;
+		resume_full_segments_size_ = full_segments_size_;
+		resume_offset_ = diverted_ ? diverted_offset_ : static_cast<size_t>(pptr() - pbase());
+		retry_refused_ = false;
+		Reset();
+	}
+
+	// the bytes following the write position were written to the segments through another stream buffer
+	void SkipWritten(tOffset count)
+	{
+		while (count > 0 && pptr() != nullptr)
+		{
+			const tOffset room = static_cast<tOffset>(epptr() - pptr());
+			const tOffset step = std::min(std::min(count, room), static_cast<tOffset>(INT_MAX));
+			pbump(static_cast<int>(step));
+			count -= step;
+			if (pptr() == epptr() && count > 0)
+			{
+				if (write_segment_ + 1 >= segments_.size())
+				{
+					return;
+				}
+				full_segments_size_ += static_cast<tOffset>(segments_[write_segment_].size_);
+				write_segment_++;
+				SetPutArea();
+			}
+		}
+	}
+
+	tOffset GetWrittenSize() const
+	{
+		return full_segments_size_ + static_cast<tOffset>(diverted_ ? diverted_offset_ : pptr() - pbase());
+	}
+
+	tOffset GetResumePoint() const
+	{
+		return resume_full_segments_size_ + static_cast<tOffset>(resume_offset_);
+	}
+
+protected:
+	int_type overflow(int_type ch) override
+	{
+		if (traits_type::eq_int_type(ch, traits_type::eof()))
+		{
+			return traits_type::not_eof(ch);
+		}
+		if (diverted_)
+		{
+			diverted_data_.push_back(traits_type::to_char_type(ch));
+			return ch;
+		}
+		if (write_segment_ + 1 >= segments_.size())
+		{
+			// no room left
+			return traits_type::eof();
+		}
+		full_segments_size_ += static_cast<tOffset>(segments_[write_segment_].size_);
+		write_segment_++;
+		SetPutArea();
+		*pptr() = traits_type::to_char_type(ch);
+		pbump(1);
+		return ch;
+	}
+
+	std::streamsize xsputn(const char* s, std::streamsize count) override
+	{
+		if (diverted_)
+		{
+			diverted_data_.append(s, static_cast<size_t>(count));
+			return count;
+		}
+		return std::streambuf::xsputn(s, count);
+	}
+
+	int_type underflow() override
+	{
+		if (diverted_)
+		{
+			if (diverted_read_ < diverted_data_.size())
+			{
+				char* begin = &diverted_data_[0];
+				setg(begin + diverted_read_, begin + diverted_read_, begin + diverted_data_.size());
+				diverted_read_ = diverted_data_.size();
+				return traits_type::to_int_type(*gptr());
+			}
+			setg(nullptr, nullptr, nullptr);
+			return traits_type::eof();
+		}
+
+		// the current segment was read entirely
+		if (eback() != nullptr)
+		{
+			read_segment_++;
+		}
+		for (; read_segment_ <= write_segment_ && read_segment_ < segments_.size(); read_segment_++)
+		{
+			char* begin = reinterpret_cast<char*>(segments_[read_segment_].data_);
+			if (read_segment_ == resume_segment_)
+			{
+				begin += resume_offset_;
+			}
+			char* end = read_segment_ == write_segment_ ? pptr() : begin + segments_[read_segment_].size_;
+			if (begin < end)
+			{
+				setg(begin, begin, end);
+				return traits_type::to_int_type(*gptr());
+			}
+		}
+		setg(nullptr, nullptr, nullptr);
+		return traits_type::eof();
+	}
 
-	Aws::IOStream& objectStream = outcome.GetResult().GetBody();
-	std::string objectData((std::istreambuf_iterator<char>(objectStream)), std::istreambuf_iterator<char>());
+private:
+	void SetPutArea()
+	{
+		if (segments_.empty())
+		{
+			setp(nullptr, nullptr);
+			return;
+		}
+		char* begin = reinterpret_cast<char*>(segments_[write_segment_].data_);
+		setp(begin, begin + segments_[write_segment_].size_);
+	}
 
-	// Convert string to vector<char>
-	contentVector.assign(objectData.begin(), objectData.end());
-	return static_cast<long long>(objectData.size());
+	Aws::Vector<BufferSegment> segments_;
+	size_t write_segment_{0};
+	tOffset full_segments_size_{0};
+	size_t read_segment_{0};
+	size_t resume_segment_{0};
+	tOffset resume_full_segments_size_{0};
+	size_t resume_offset_{0};
+	bool retry_refused_{false};
+
+	// body of a response that is not the requested range
+	bool diverted_{false};
+	size_t diverted_offset_{0};
+	Aws::String diverted_data_;
+	size_t diverted_read_{0};
+};
+
+// Whether a response carries the requested bytes. With some HTTP clients the status code is only known once the
+// transfer ends, but the body of a ranged GET always comes with its Content-Range.
+bool CarriesRequestedRange(const Aws::Http::HttpResponse& response)
+{
+	const auto response_code = response.GetResponseCode();
+	if (response_code != Aws::Http::HttpResponseCode::REQUEST_NOT_MADE)
+	{
+		return response_code == Aws::Http::HttpResponseCode::OK ||
+		       response_code == Aws::Http::HttpResponseCode::PARTIAL_CONTENT;
+	}
+	if (!response.HasHeader("content-range"))
+	{
+		return false;
+	}
+	// an unsatisfiable range is answered with "bytes */<size>"
+	const Aws::String content_range = response.GetHeader("content-range");
+	return content_range.find('*') == Aws::String::npos;
 }
 
-SizeOutcome DownloadFileRangeToBuffer(const Aws::String& bucket, const Aws::String& object_name, unsigned char* buffer,
-				      std::int64_t start_range, std::int64_t end_range)
+// Route the body of a GET response to the stream buffer: only a response carrying the requested range writes to the
+// segments, and an SDK retry after some data was received is cancelled
+void SetSegmentedResponseStream(Aws::S3::Model::GetObjectRequest& request, SegmentedStreamBuf* stream_buf)
 {
-	// Note: AWS byte ranges are inclusive
-	auto request = MakeGetObjectRequest(bucket, object_name, MakeByteRange(start_range, end_range));
-	auto outcome = client->GetObject(request);
-	RETURN_OUTCOME_ON_ERROR(outcome);
+	request.SetResponseStreamFactory(
+	    [stream_buf]()
+	    {
+		    stream_buf->StartResponse();
+		    return Aws::New<Aws::IOStream>(KHIOPS_S3, stream_buf);
+	    });
+	request.SetHeadersReceivedEventHandler(
+	    [stream_buf](const Aws::Http::HttpRequest*, Aws::Http::HttpResponse* response)
+	    {
+		    if (!CarriesRequestedRange(*response))
+		    {
+			    stream_buf->Divert();
+		    }
+	    });
+	request.SetContinueRequestHandler([stream_buf](const Aws::Http::HttpRequest*)
+					  { return !stream_buf->IsRetryRefused(); });
+}
 
-	// get ownership of the result and its underlying stream
-	Aws::S3::Model::GetObjectResult result{outcome.GetResultWithOwnership()};
-	auto& stream = result.GetBody();
-	// remember comment above about inclusive byte ranges
-	stream.read(reinterpret_cast<char*>(buffer), end_range - start_range + 1);
+// One of the identical GET requests racing for the same range. Only the attempt whose response carries the range
+// first writes its body: the first attempt straight to the caller's segments, the duplicate to a buffer of its own.
+struct HedgedAttempt
+{
+	Aws::Vector<unsigned char> data_;
+	Aws::UniquePtr<SegmentedStreamBuf> stream_buf_;
+	Aws::S3::Model::GetObjectOutcome outcome_;
+	bool done_{false};
+};
+
+struct HedgeState
+{
+	std::mutex mutex_;
+	std::condition_variable cond_;
+	HedgedAttempt attempts_[2];
+	int winner_{-1};      // the first attempt to receive a response carrying the range
+	bool settled_{false}; // the caller has its result, the other attempt is cancelled
+};
+
+void RunHedgedAttempt(const std::shared_ptr<HedgeState>& state, int index, Aws::S3::Model::GetObjectRequest request)
+{
+	HedgedAttempt& attempt = state->attempts_[index];
+	SegmentedStreamBuf* stream_buf = attempt.stream_buf_.get();
+	HedgeState* shared = state.get();
+	const auto start = std::chrono::steady_clock::now();
 
-	if (stream.bad())
 	{
-		return MakeSimpleError(Aws::S3::S3Errors::INTERNAL_FAILURE, "Failed to read stream content");
+		std::lock_guard<std::mutex> lock(shared->mutex_);
+		if (shared->settled_)
+		{
+			// the race was over before the attempt could start
+			attempt.done_ = true;
+			shared->cond_.notify_all();
+			return;
+		}
+	}
+
+	SetSegmentedResponseStream(request, stream_buf);
+	request.SetHeadersReceivedEventHandler(
+	    [shared, index, stream_buf, start](const Aws::Http::HttpRequest*, Aws::Http::HttpResponse* response)
+	    {
+		    std::lock_guard<std::mutex> lock(shared->mutex_);
+		    if (shared->winner_ < 0 && !shared->settled_ && CarriesRequestedRange(*response))
+		    {
+			    shared->winner_ = index;
+			    first_byte_latency.Record(
+				std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start));
+			    shared->cond_.notify_all();
+		    }
+		    if (shared->winner_ != index)
+		    {
+			    stream_buf->Divert();
+		    }
+	    });
+	request.SetContinueRequestHandler(
+	    [shared, index, stream_buf](const Aws::Http::HttpRequest*)
+	    {
+		    if (stream_buf->IsRetryRefused())
+		    {
+			    return false;
+		    }
+		    std::lock_guard<std::mutex> lock(shared->mutex_);
+		    return shared->winner_ == index || (shared->winner_ < 0 && !shared->settled_);
+	    });
+
+	auto outcome = client->GetObject(request);
+
+	std::lock_guard<std::mutex> lock(shared->mutex_);
+	attempt.outcome_ = std::move(outcome);
+	attempt.done_ = true;
+	shared->cond_.notify_all();
+}
+
+// Delay after which a GET is duplicated. Hedging needs the usual latency, and a caller outside of the pool: a task
+// of the pool waiting for attempts queued behind it could wait forever.
+bool GetHedgeDelay(std::chrono::microseconds& delay)
+{
+	if (read_config.hedge_percentile_ == 0 || on_executor_thread ||
+	    !first_byte_latency.GetPercentile(read_config.hedge_percentile_, delay))
+	{
+		return false;
+	}
+	delay = std::max(delay, std::chrono::microseconds{std::chrono::milliseconds{read_config.hedge_min_delay_ms_}});
+	return true;
+}
+
+// Time the first response carrying the range of a GET that is not hedged, the hedging delay derives from them
+void TimeFirstResponse(Aws::S3::Model::GetObjectRequest& request)
+{
+	const auto start = std::chrono::steady_clock::now();
+	const auto headers_handler = request.GetHeadersReceivedEventHandler();
+	request.SetHeadersReceivedEventHandler(
+	    [headers_handler, start](const Aws::Http::HttpRequest* http_request, Aws::Http::HttpResponse* response)
+	    {
+		    headers_handler(http_request, response);
+		    if (CarriesRequestedRange(*response))
+		    {
+			    first_byte_latency.Record(
+				std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start));
+		    }
+	    });
+}
+
+// Send a GET request on the pool, then a duplicate if no response carried the range once the delay has passed. The
+// body of the winner ends up in stream_buf, which covers the segments from their start; the other attempt is
+// cancelled.
+Aws::S3::Model::GetObjectOutcome GetObjectHedged(const Aws::S3::Model::GetObjectRequest& request,
+						 const Aws::Vector<BufferSegment>& segments,
+						 SegmentedStreamBuf& stream_buf, std::chrono::microseconds delay)
+{
+	auto state = Aws::MakeShared<HedgeState>(KHIOPS_S3);
+	auto launch = [&state, &request](int index)
+	{ SubmitTask([state, index, request]() { RunHedgedAttempt(state, index, request); }); };
+
+	state->attempts_[0].stream_buf_ = Aws::MakeUnique<SegmentedStreamBuf>(KHIOPS_S3, segments);
+	launch(0);
+
+	std::unique_lock<std::mutex> lock(state->mutex_);
+	int launched = 1;
+	if (!state->cond_.wait_for(lock, delay,
+				   [&]() { return state->winner_ >= 0 || state->attempts_[0].done_; }))
+	{
+		spdlog::debug("no answer after {} us, hedging the request", delay.count());
+		size_t length = 0;
+		for (const auto& segment : segments)
+		{
+			length += segment.size_;
+		}
+		HedgedAttempt& duplicate = state->attempts_[1];
+		duplicate.data_.resize(length);
+		duplicate.stream_buf_ = Aws::MakeUnique<SegmentedStreamBuf>(
+		    KHIOPS_S3, Aws::Vector<BufferSegment>{BufferSegment{duplicate.data_.data(), length}});
+		lock.unlock();
+		launch(1);
+		lock.lock();
+		launched = 2;
+	}
+	state->cond_.wait(lock,
+			  [&]()
+			  {
+				  if (state->winner_ >= 0)
+				  {
+					  return state->attempts_[state->winner_].done_;
+				  }
+				  for (int i = 0; i < launched; i++)
+				  {
+					  if (!state->attempts_[i].done_)
+					  {
+						  return false;
+					  }
+				  }
+				  return true;
+			  });
+	state->settled_ = true;
+	const int chosen = std::max(state->winner_, 0);
+	lock.unlock();
+
+	// the attempt is done, the other one does not write to the segments
+	HedgedAttempt& attempt = state->attempts_[chosen];
+	auto outcome = std::move(attempt.outcome_);
+	std::ostream to_segments(&stream_buf);
+	auto to_caller = [&]()
+	{
+		const tOffset written = attempt.stream_buf_->GetWrittenSize();
+		if (chosen == 0)
+		{
+			stream_buf.SkipWritten(written);
+		}
+		else
+		{
+			to_segments.write(reinterpret_cast<const char*>(attempt.data_.data()),
+					  static_cast<std::streamsize>(written));
+		}
+	};
+
+	if (!outcome.IsSuccess())
+	{
+		// the data of an interrupted transfer is kept, it is resumed from there
+		to_caller();
+		return outcome;
+	}
+
+	Aws::S3::Model::GetObjectResult result{outcome.GetResultWithOwnership()};
+	auto& body = result.GetBody();
+	const bool failed = body.bad();
+	if (body.rdbuf() != attempt.stream_buf_.get())
+	{
+		to_segments << body.rdbuf();
+	}
+	else
+	{
+		to_caller();
+	}
+	result.ReplaceBody(Aws::New<Aws::IOStream>(KHIOPS_S3, &stream_buf));
+	if (failed)
+	{
+		result.GetBody().setstate(std::ios::badbit);
+	}
+	return Aws::S3::Model::GetObjectOutcome(std::move(result));
+}
+
+// Download an inclusive byte range into the segments, without intermediate copy.
+// If if_match is set, the download fails if the object does not have this ETag anymore
+SizeOutcome DownloadFileRangeToSegments(const Aws::String& bucket, const Aws::String& object_name,
+					Aws::Vector<BufferSegment> segments, std::int64_t start_range,
+					std::int64_t end_range, const Aws::String& if_match = "",
+					Aws::Map<Aws::String, Aws::String>* metadata = nullptr)
+{
+	SegmentedStreamBuf stream_buf{segments};
+
+	// Note: AWS byte ranges are inclusive
+	auto request = MakeGetObjectRequest(bucket, object_name, MakeByteRange(start_range, end_range));
+	if (!if_match.empty())
+	{
+		request.SetIfMatch(if_match);
+	}
+	SetSegmentedResponseStream(request, &stream_buf);
+
+	Aws::S3::Model::GetObjectOutcome outcome;
+	std::chrono::microseconds hedge_delay{0};
+	if (GetHedgeDelay(hedge_delay))
+	{
+		outcome = GetObjectHedged(request, segments, stream_buf, hedge_delay);
+	}
+	else if (read_config.hedge_percentile_ > 0)
+	{
+		auto timed_request = request;
+		TimeFirstResponse(timed_request);
+		outcome = client->GetObject(timed_request);
+	}
+	else
+	{
+		outcome = client->GetObject(request);
+	}
+
+	// Only a response carrying the range writes to the segments: a failure after some bytes were written is an
+	// interrupted transfer. It is resumed from the first missing byte, as long as each attempt makes progress. The
+	// SDK does not retry it itself, it would download the whole range again.
+	while (!outcome.IsSuccess() && stream_buf.GetWrittenSize() > stream_buf.GetResumePoint())
+	{
+		stream_buf.SetResumePoint();
+		const std::int64_t resume_start = start_range + stream_buf.GetResumePoint();
+		if (resume_start > end_range)
+		{
+			// the whole range was received before the failure
+			return stream_buf.GetWrittenSize();
+		}
+		spdlog::debug("resuming download of {} @ {}", object_name, resume_start);
+		request.SetRange(MakeByteRange(resume_start, end_range));
+		outcome = client->GetObject(request);
+	}
+
+	if (!outcome.IsSuccess() &&
+	    outcome.GetError().GetResponseCode() == Aws::Http::HttpResponseCode::PRECONDITION_FAILED)
+	{
+		return MakeSimpleError(Aws::S3::S3Errors::INVALID_PARAMETER_VALUE,
+				       "Object modified since it was opened: " + object_name);
+	}
+	RETURN_OUTCOME_ON_ERROR(outcome);
+
+	// get ownership of the result and its underlying stream
+	Aws::S3::Model::GetObjectResult result{outcome.GetResultWithOwnership()};
+	auto& stream = result.GetBody();
+	if (stream.rdbuf() != &stream_buf)
+	{
+		// the body did not come through the factory, copy it
+		std::ostream to_segments(&stream_buf);
+		to_segments << stream.rdbuf();
+	}
+
+	if (stream.bad())
+	{
+		return MakeSimpleError(Aws::S3::S3Errors::INTERNAL_FAILURE, "Failed to read stream content");
+	}
+	if (metadata)
+	{
+		*metadata = result.GetMetadata();
+	}
+
+	return stream_buf.GetWrittenSize();
+}
+
+SizeOutcome DownloadFileRangeToBuffer(const Aws::String& bucket, const Aws::String& object_name, unsigned char* buffer,
+				      std::int64_t start_range, std::int64_t end_range, const Aws::String& if_match = "")
+{
+	// remember comment above about inclusive byte ranges
+	const size_t length = static_cast<size_t>(end_range - start_range + 1);
+	return DownloadFileRangeToSegments(bucket, object_name, {BufferSegment{buffer, length}}, start_range,
+					   end_range, if_match);
+}
+
+SizeOutcome DownloadFileRangeToVector(const Aws::String& bucket, const Aws::String& object_name, Aws::Vector<unsigned char>& contentVector,
+					std::int64_t start_range, std::int64_t end_range)
+{
+	contentVector.resize(static_cast<size_t>(end_range - start_range + 1));
+	auto outcome = DownloadFileRangeToBuffer(bucket, object_name, contentVector.data(), start_range, end_range);
+	PASS_OUTCOME_ON_ERROR(outcome);
+	contentVector.resize(static_cast<size_t>(outcome.GetResult()));
+	return outcome;
+}
+
+// Size of the object storing a part of the multifile
+tOffset GetPartSize(const MultiPartFile& multifile, size_t part)
+{
+	const auto& cumul_sizes = multifile.layout_->cumulative_sizes_;
+	return part == 0 ? cumul_sizes[0]
+			 : cumul_sizes[part] - cumul_sizes[part - 1] + multifile.layout_->common_header_length_;
+}
+
+int GetProcessId()
+{
+#ifdef __unix_or_mac__
+	return static_cast<int>(getpid());
+#else
+	return _getpid();
+#endif
+}
+
+// Create the directory if it does not exist, the parent directory must exist
+bool MakeLocalDirectory(const Aws::String& path)
+{
+#ifdef __unix_or_mac__
+	const int status = mkdir(path.c_str(), 0755);
+#else
+	const int status = _mkdir(path.c_str());
+#endif
+	return status == 0 || errno == EEXIST;
+}
+
+// Set the modification time of a file to now, returns false if the file does not exist
+bool TouchLocalFile(const Aws::String& path)
+{
+#ifdef __unix_or_mac__
+	return utime(path.c_str(), nullptr) == 0;
+#else
+	return _utime(path.c_str(), nullptr) == 0;
+#endif
+}
+
+// On-disk block cache, shared by all the processes using the same directory. A block is stored in
+// a file named after a hash of its key, the key itself is written at the beginning of the file to
+// detect collisions. The ETag is part of the key, so a block can only be stale if the object is
+// modified while it is being read, which the downloads detect with If-Match. The size of the
+// directory is bounded by listing it, with the modification time of a file as its last use: reading
+// a block touches its file.
+
+void DiskCacheIndex::Reset(size_t budget)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	entries_.clear();
+	versions_.clear();
+	use_count_ = 0;
+	budget_ = budget;
+	usage_ = 0;
+}
+
+size_t DiskCacheIndex::GetUsage() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return usage_;
+}
+
+Aws::Vector<Aws::String> DiskCacheIndex::Insert(const Aws::String& path, const Aws::String& object_key,
+						 const Aws::String& etag, size_t size, bool written, bool& over_budget)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	Aws::Vector<Aws::String> removed;
+
+	auto& version = versions_[object_key];
+	if (!version.empty() && version != etag)
+	{
+		for (auto it = entries_.begin(); it != entries_.end();)
+		{
+			if (it->second.object_key_ == object_key && it->second.etag_ != etag)
+			{
+				usage_ -= std::min(usage_, it->second.size_);
+				removed.push_back(it->first);
+				it = entries_.erase(it);
+			}
+			else
+			{
+				it++;
+			}
+		}
+	}
+	version = etag;
+
+	// a block read was counted when the directory was listed, or when it was written
+	auto& entry = entries_[path];
+	if (written)
+	{
+		usage_ = usage_ - std::min(usage_, entry.size_) + size;
+	}
+	entry = Entry{object_key, etag, size, ++use_count_};
+
+	over_budget = usage_ > budget_ + budget_ / 8;
+	return removed;
+}
+
+Aws::Vector<Aws::String> DiskCacheIndex::Evict(Aws::Vector<DiskCacheFile> files)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	size_t usage{0};
+	std::unordered_map<Aws::String, Entry> listed_entries;
+	for (const auto& file : files)
+	{
+		usage += file.size_;
+		const auto known = entries_.find(file.path_);
+		if (known != entries_.end())
+		{
+			listed_entries.emplace(file.path_, known->second);
+		}
+	}
+	// the files removed by other processes are forgotten
+	entries_.swap(listed_entries);
+
+	auto last_use = [this](const DiskCacheFile& file)
+	{
+		const auto known = entries_.find(file.path_);
+		return known == entries_.end() ? 0ULL : known->second.last_use_;
+	};
+	std::sort(files.begin(), files.end(),
+		  [&](const DiskCacheFile& a, const DiskCacheFile& b)
+		  { return a.mtime_ != b.mtime_ ? a.mtime_ < b.mtime_ : last_use(a) < last_use(b); });
+
+	Aws::Vector<Aws::String> removed;
+	for (auto it = files.begin(); it != files.end() && usage > budget_; it++)
+	{
+		usage -= it->size_;
+		removed.push_back(it->path_);
+		entries_.erase(it->path_);
+	}
+	usage_ = usage;
+	return removed;
+}
+
+Aws::String SerializeBlockCacheKey(const BlockCacheKey& key)
+{
+	Aws::String serialized;
+	serialized.append(key.bucket_).push_back('\0');
+	serialized.append(key.object_).push_back('\0');
+	serialized.append(key.etag_).push_back('\0');
+	serialized.append(std::to_string(key.index_));
+	return serialized;
+}
+
+Aws::String MakeDiskCacheBlockPath(const Aws::String& serialized_key, tOffset index)
+{
+	Aws::OStringStream path;
+	path << read_config.cache_dir_ << '/' << HashToHex(serialized_key) << '-' << index << ".blk";
+	return path.str();
+}
+
+// Key and data size at the beginning of a block file
+bool ReadDiskCacheHeader(Aws::IFStream& file, Aws::String& stored_key, uint64_t& data_size)
+{
+	uint64_t key_size{0};
+	file.read(reinterpret_cast<char*>(&key_size), sizeof(key_size));
+	if (!file || key_size > 64 * 1024)
+	{
+		return false;
+	}
+	stored_key.assign(static_cast<size_t>(key_size), '\0');
+	file.read(&stored_key[0], static_cast<std::streamsize>(key_size));
+	file.read(reinterpret_cast<char*>(&data_size), sizeof(data_size));
+	return static_cast<bool>(file);
+}
+
+size_t GetDiskCacheFileSize(const Aws::String& serialized_key, uint64_t data_size)
+{
+	return 2 * sizeof(uint64_t) + serialized_key.size() + static_cast<size_t>(data_size);
+}
+
+void RemoveDiskCacheFiles(const Aws::Vector<Aws::String>& paths)
+{
+	for (const auto& path : paths)
+	{
+		// another process may have removed it already
+		std::remove(path.c_str());
+	}
+}
+
+Aws::Vector<DiskCacheFile> ListDiskCacheFiles();
+
+// Measure the cache directory and remove its least recently used files beyond the budget
+void EnforceDiskCacheBudget()
+{
+	RemoveDiskCacheFiles(disk_cache_index.Evict(ListDiskCacheFiles()));
+	spdlog::debug("Disk cache {}: {} bytes in use", read_config.cache_dir_, disk_cache_index.GetUsage());
+}
+
+// Record a block file in the index of the disk cache, with the files it evicts removed
+void IndexDiskCacheBlock(const Aws::String& path, const BlockCacheKey& key, size_t file_size, bool written)
+{
+	bool over_budget{false};
+	RemoveDiskCacheFiles(disk_cache_index.Insert(path, MakeMetadataCacheKey(key.bucket_, key.object_), key.etag_,
+						     file_size, written, over_budget));
+	if (over_budget)
+	{
+		EnforceDiskCacheBudget();
+	}
+}
+
+BlockData ReadDiskCacheBlock(const BlockCacheKey& key)
+{
+	if (read_config.cache_dir_.empty())
+	{
+		return nullptr;
+	}
+
+	const Aws::String serialized_key = SerializeBlockCacheKey(key);
+	const Aws::String path = MakeDiskCacheBlockPath(serialized_key, key.index_);
+	Aws::IFStream file(path, std::ios::binary);
+	if (!file)
+	{
+		return nullptr;
+	}
+
+	Aws::String stored_key;
+	uint64_t data_size{0};
+	if (!ReadDiskCacheHeader(file, stored_key, data_size) || stored_key != serialized_key ||
+	    data_size > static_cast<uint64_t>(read_config.cache_block_size_))
+	{
+		return nullptr;
+	}
+
+	auto data = Aws::MakeShared<Aws::Vector<unsigned char>>(KHIOPS_S3, static_cast<size_t>(data_size));
+	file.read(reinterpret_cast<char*>(data->data()), static_cast<std::streamsize>(data_size));
+	if (file.gcount() != static_cast<std::streamsize>(data_size))
+	{
+		return nullptr;
+	}
+	file.close();
+
+	// most recently used, possibly stored by another process
+	TouchLocalFile(path);
+	IndexDiskCacheBlock(path, key, GetDiskCacheFileSize(serialized_key, data_size), false);
+	return data;
+}
+
+bool DiskCacheContains(const BlockCacheKey& key)
+{
+	if (read_config.cache_dir_.empty())
+	{
+		return false;
+	}
+	Aws::IFStream file(MakeDiskCacheBlockPath(SerializeBlockCacheKey(key), key.index_), std::ios::binary);
+	return file.is_open();
+}
+
+void WriteDiskCacheBlock(const BlockCacheKey& key, const Aws::Vector<unsigned char>& data)
+{
+	const Aws::String serialized_key = SerializeBlockCacheKey(key);
+	const Aws::String path = MakeDiskCacheBlockPath(serialized_key, key.index_);
+
+	// write to a private file first, other processes only ever see complete blocks
+	static std::atomic<unsigned> write_count{0};
+	Aws::OStringStream temp_path_os;
+	temp_path_os << path << '.' << GetProcessId() << '.' << write_count++ << ".tmp";
+	const Aws::String temp_path = temp_path_os.str();
+
+	const uint64_t key_size = serialized_key.size();
+	const uint64_t data_size = data.size();
+	std::ofstream file(temp_path, std::ios::binary);
+	file.write(reinterpret_cast<const char*>(&key_size), sizeof(key_size));
+	file.write(serialized_key.data(), static_cast<std::streamsize>(key_size));
+	file.write(reinterpret_cast<const char*>(&data_size), sizeof(data_size));
+	file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data_size));
+	file.close();
+
+	// the rename fails on some platforms if the block was stored in the meantime, nothing is lost
+	if (!file || 0 != std::rename(temp_path.c_str(), path.c_str()))
+	{
+		spdlog::debug("Block {} not stored in the disk cache", path);
+		std::remove(temp_path.c_str());
+		return;
+	}
+	IndexDiskCacheBlock(path, key, GetDiskCacheFileSize(serialized_key, data_size), true);
+}
+
+// Block files of the cache directory, without opening them
+Aws::Vector<DiskCacheFile> ListDiskCacheFiles()
+{
+	Aws::Vector<Aws::String> names;
+#ifdef __unix_or_mac__
+	DIR* dir = opendir(read_config.cache_dir_.c_str());
+	if (dir == nullptr)
+	{
+		return {};
+	}
+	while (const dirent* entry = readdir(dir))
+	{
+		names.emplace_back(entry->d_name);
+	}
+	closedir(dir);
+#else
+	_finddata_t found;
+	const Aws::String filter = read_config.cache_dir_ + "/*.blk";
+	const intptr_t search = _findfirst(filter.c_str(), &found);
+	if (search == -1)
+	{
+		return {};
+	}
+	do
+	{
+		names.emplace_back(found.name);
+	} while (_findnext(search, &found) == 0);
+	_findclose(search);
+#endif
+
+	constexpr char suffix[] = ".blk";
+	constexpr size_t suffix_size = sizeof(suffix) - 1;
+	Aws::Vector<DiskCacheFile> files;
+	for (const auto& name : names)
+	{
+		if (name.size() <= suffix_size || name.compare(name.size() - suffix_size, suffix_size, suffix) != 0)
+		{
+			continue;
+		}
+		const Aws::String path = read_config.cache_dir_ + '/' + name;
+		struct stat file_stat;
+		if (stat(path.c_str(), &file_stat) == 0)
+		{
+			files.push_back(DiskCacheFile{path, static_cast<size_t>(file_stat.st_size),
+						      static_cast<long long>(file_stat.st_mtime)});
+		}
+	}
+	return files;
+}
+
+// Prepare the cache directory and measure the blocks already there
+void ConfigureDiskCache()
+{
+	disk_cache_index.Reset(read_config.cache_dir_size_);
+	if (read_config.cache_dir_.empty())
+	{
+		return;
+	}
+	if (!MakeLocalDirectory(read_config.cache_dir_))
+	{
+		spdlog::warn("Cannot use cache directory {}, the disk cache is disabled", read_config.cache_dir_);
+		read_config.cache_dir_.clear();
+		return;
+	}
+	EnforceDiskCacheBudget();
+}
+
+// Block from the memory cache, or else from the disk cache
+BlockData GetCachedBlock(const BlockCacheKey& key)
+{
+	BlockData data = block_cache.Lookup(key);
+	if (!data)
+	{
+		data = ReadDiskCacheBlock(key);
+		if (data)
+		{
+			block_cache.Insert(key, data);
+		}
+	}
+	return data;
+}
+
+bool IsBlockCached(const BlockCacheKey& key)
+{
+	return block_cache.Contains(key) || DiskCacheContains(key);
+}
+
+void StoreCachedBlock(const BlockCacheKey& key, BlockData data)
+{
+	if (!read_config.cache_dir_.empty())
+	{
+		WriteDiskCacheBlock(key, *data);
+	}
+	block_cache.Insert(key, std::move(data));
+}
+
+// Download consecutive missing blocks of an object and cache them. Readers missing the same blocks at the same
+// time share the download.
+SimpleOutcome<DownloadedRun> DownloadBlockRun(const Aws::String& bucket, const Aws::String& object,
+					      const Aws::String& etag, tOffset first_index, tOffset run_start,
+					      tOffset run_end, tOffset part_size)
+{
+	Aws::String flight_key = MakeMetadataCacheKey(bucket, object);
+	flight_key.push_back('\0');
+	flight_key.append(etag);
+	flight_key.push_back('\0');
+	flight_key.append(MakeByteRange(run_start, run_end));
+
+	return block_run_flights.Do(
+	    flight_key,
+	    [&]() -> SimpleOutcome<DownloadedRun>
+	    {
+		    const tOffset block_size = read_config.cache_block_size_;
+
+		    // the body is written straight into the new blocks
+		    DownloadedRun run;
+		    Aws::Vector<BufferSegment> segments;
+		    for (tOffset block_start = run_start; block_start <= run_end; block_start += block_size)
+		    {
+			    const tOffset block_length = std::min(block_size, part_size - block_start);
+			    run.blocks_.push_back(
+				Aws::MakeShared<Aws::Vector<unsigned char>>(KHIOPS_S3, static_cast<size_t>(block_length)));
+			    segments.push_back(BufferSegment{run.blocks_.back()->data(), static_cast<size_t>(block_length)});
+		    }
+		    const auto download_outcome =
+			DownloadFileRangeToSegments(bucket, object, std::move(segments), static_cast<int64_t>(run_start),
+						    static_cast<int64_t>(run_end), etag);
+		    PASS_OUTCOME_ON_ERROR(download_outcome);
+		    run.read_ = download_outcome.GetResult();
+
+		    // only complete blocks are cached
+		    for (size_t i = 0; i < run.blocks_.size(); i++)
+		    {
+			    const tOffset block_start = run_start + static_cast<tOffset>(i) * block_size;
+			    if (run_start + run.read_ - block_start >= static_cast<tOffset>(run.blocks_[i]->size()))
+			    {
+				    StoreCachedBlock(BlockCacheKey{bucket, object, etag, first_index + static_cast<tOffset>(i)},
+						     run.blocks_[i]);
+			    }
+		    }
+		    return run;
+	    });
+}
+
+// The segments holding length bytes from the given position of a sequence of segments
+Aws::Vector<BufferSegment> SliceSegments(const Aws::Vector<BufferSegment>& segments, tOffset offset, tOffset length)
+{
+	Aws::Vector<BufferSegment> slice;
+	for (const auto& segment : segments)
+	{
+		if (length <= 0)
+		{
+			break;
+		}
+		const tOffset segment_size = static_cast<tOffset>(segment.size_);
+		if (offset >= segment_size)
+		{
+			offset -= segment_size;
+			continue;
+		}
+		const tOffset taken = std::min(segment_size - offset, length);
+		slice.push_back(BufferSegment{segment.data_ + offset, static_cast<size_t>(taken)});
+		offset = 0;
+		length -= taken;
+	}
+	return slice;
+}
+
+void CopyToSegments(const Aws::Vector<BufferSegment>& segments, tOffset offset, const unsigned char* data,
+		    tOffset length)
+{
+	for (const auto& segment : SliceSegments(segments, offset, length))
+	{
+		std::copy_n(data, segment.size_, segment.data_);
+		data += segment.size_;
+	}
+}
+
+// Read the inclusive byte range of a part into the segments, through the block caches. Runs of missing blocks are
+// downloaded with one request each and stored in the caches.
+SizeOutcome ReadPartRange(const MultiPartFile& multifile, size_t part, const Aws::Vector<BufferSegment>& segments,
+			  tOffset start, tOffset end)
+{
+	const Aws::String& bucket = multifile.bucketname_;
+	const Aws::String object = multifile.layout_->parts_.GetKey(part);
+	const Aws::String etag = multifile.layout_->parts_.GetETag(part);
+
+	// without a version, cached blocks could be stale
+	if (etag.empty() || (block_cache.GetBudget() == 0 && read_config.cache_dir_.empty()))
+	{
+		return DownloadFileRangeToSegments(bucket, object, segments, static_cast<int64_t>(start),
+						   static_cast<int64_t>(end), etag);
+	}
+
+	const tOffset part_size = GetPartSize(multifile, part);
+	const tOffset block_size = read_config.cache_block_size_;
+	end = std::min(end, part_size - 1);
+
+	BlockCacheKey key{bucket, object, etag, start / block_size};
+	const tOffset last_block = end / block_size;
+	tOffset pos = start;
+
+	auto copy_from_block = [&](const unsigned char* block_data, tOffset block_start, tOffset block_length)
+	{
+		const tOffset copy_end = std::min(end + 1, block_start + block_length);
+		if (copy_end > pos)
+		{
+			CopyToSegments(segments, pos - start, block_data + (pos - block_start), copy_end - pos);
+			pos = copy_end;
+		}
+	};
+
+	while (pos <= end)
+	{
+		const BlockData cached = GetCachedBlock(key);
+		if (cached)
+		{
+			copy_from_block(cached->data(), key.index_ * block_size, static_cast<tOffset>(cached->size()));
+			key.index_++;
+			continue;
+		}
+
+		// extend the download to the following missing blocks
+		const tOffset first_missing = key.index_;
+		BlockCacheKey next_key = key;
+		while (next_key.index_ < last_block)
+		{
+			next_key.index_++;
+			if (IsBlockCached(next_key))
+			{
+				break;
+			}
+			key.index_ = next_key.index_;
+		}
+
+		const tOffset run_start = first_missing * block_size;
+		const tOffset run_end = std::min((key.index_ + 1) * block_size, part_size) - 1;
+		const auto run_outcome = DownloadBlockRun(bucket, object, etag, first_missing, run_start, run_end, part_size);
+		PASS_OUTCOME_ON_ERROR(run_outcome);
+		const DownloadedRun& run = run_outcome.GetResult();
+		const tOffset run_read = run.read_;
+
+		for (size_t i = 0; i < run.blocks_.size(); i++)
+		{
+			const tOffset block_start = run_start + static_cast<tOffset>(i) * block_size;
+			const auto& block = run.blocks_[i];
+			const tOffset block_read =
+			    std::min(static_cast<tOffset>(block->size()), std::max(tOffset{0}, run_start + run_read - block_start));
+			copy_from_block(block->data(), block_start, block_read);
+		}
+
+		if (run_read < run_end - run_start + 1)
+		{
+			spdlog::debug("End of file encountered");
+			break;
+		}
+		key.index_++;
+	}
+
+	return pos - start;
+}
+
+SizeOutcome ReadPartRange(const MultiPartFile& multifile, size_t part, unsigned char* buffer, tOffset start,
+			  tOffset end)
+{
+	return ReadPartRange(multifile, part, {BufferSegment{buffer, static_cast<size_t>(end - start + 1)}}, start, end);
+}
+
+// Read to_read bytes of the multifile starting at the given offset into the segments, without changing the reader
+// state
+SizeOutcome ReadMultifileRangeToSegments(const MultiPartFile& multifile, tOffset offset,
+					 const Aws::Vector<BufferSegment>& segments, tOffset to_read)
+{
+	// Start at first usable file chunk
+	// Advance through file chunks, advancing buffer pointer
+	// Until last requested byte was read
+	// Or error occured
+
+	tOffset bytes_read{0};
+
+	// Lookup item containing initial bytes at requested offset
+	const auto& cumul_sizes = multifile.layout_->cumulative_sizes_;
+	const tOffset common_header_length = multifile.layout_->common_header_length_;
+
+	auto greater_than_offset_it = std::upper_bound(cumul_sizes.begin(), cumul_sizes.end(), offset);
+	size_t idx = static_cast<size_t>(std::distance(cumul_sizes.begin(), greater_than_offset_it));
+
+	spdlog::debug("Use item {} to read @ {} (end = {})", idx, offset, *greater_than_offset_it);
+
+	auto read_range_and_update = [&](size_t part, tOffset start, tOffset end) -> SizeOutcome
+	{
+		auto download_outcome =
+		    ReadPartRange(multifile, part, SliceSegments(segments, bytes_read, end - start + 1), start, end);
+		if (!download_outcome.IsSuccess())
+		{
+			return download_outcome.GetError();
+		}
+
+		tOffset actual_read = download_outcome.GetResult();
+
+		spdlog::debug("read = {}", actual_read);
+
+		bytes_read += actual_read;
+
+		if (actual_read < (end - start + 1) /*expected read*/)
+		{
+			spdlog::debug("End of file encountered");
+			to_read = 0;
+		}
+		else
+		{
+			to_read -= actual_read;
+		}
+
+		return actual_read;
+	};
+
+	// first file read
+
+	// AWS peculiarity: byte ranges are inclusive
+	const tOffset file_start = (idx == 0) ? offset : offset - cumul_sizes[idx - 1] + common_header_length;
+	const tOffset read_end = std::min(file_start + to_read, file_start + cumul_sizes[idx] - offset) - 1;
+
+	SizeOutcome read_outcome = read_range_and_update(idx, file_start, read_end);
+
+	// continue with the next files
+	while (read_outcome.IsSuccess() && to_read)
+	{
+		// read the missing bytes in the next files as necessary
+		idx++;
+		const tOffset start = common_header_length;
+		const tOffset end = std::min(start + to_read, start + cumul_sizes[idx] - cumul_sizes[idx - 1]) - 1;
+
+		read_outcome = read_range_and_update(idx, start, end);
+	}
+
+	if (read_outcome.IsSuccess())
+	{
+		read_outcome.GetResult() = bytes_read;
+	}
+
+	return read_outcome;
+}
+
+// Read to_read bytes of the multifile starting at the given offset, without changing the reader state
+SizeOutcome ReadMultifileRange(const MultiPartFile& multifile, tOffset offset, unsigned char* buffer, tOffset to_read)
+{
+	return ReadMultifileRangeToSegments(multifile, offset, {BufferSegment{buffer, static_cast<size_t>(to_read)}},
+					    to_read);
+}
+
+// Read a large range with concurrent requests, each one filling its own stripe of the buffer
+SizeOutcome ReadMultifileRangeStriped(const MultiPartFile& multifile, tOffset offset, unsigned char* buffer,
+				      tOffset to_read)
+{
+	const tOffset stripe_size = read_config.stripe_size_;
+	if (stripe_size <= 0 || to_read <= stripe_size)
+	{
+		return ReadMultifileRange(multifile, offset, buffer, to_read);
+	}
+
+	Aws::Vector<std::future<SizeOutcome>> stripes;
+	Aws::Vector<tOffset> stripe_lengths;
+	for (tOffset stripe_start = 0; stripe_start < to_read; stripe_start += stripe_size)
+	{
+		const tOffset stripe_offset = offset + stripe_start;
+		const tOffset stripe_length = std::min(stripe_size, to_read - stripe_start);
+		unsigned char* stripe_buffer = buffer + stripe_start;
+		stripes.push_back(SubmitTask(
+		    [&multifile, stripe_offset, stripe_buffer, stripe_length]()
+		    { return ReadMultifileRange(multifile, stripe_offset, stripe_buffer, stripe_length); }));
+		stripe_lengths.push_back(stripe_length);
+	}
+
+	spdlog::debug("read of {} bytes @ {} split in {} stripes", to_read, offset, stripes.size());
+
+	// every stripe is waited for, even after an error, since they all write to the caller's buffer
+	tOffset bytes_read{0};
+	bool contiguous = true;
+	SizeOutcome failed_outcome;
+	bool failed = false;
+	for (size_t i = 0; i < stripes.size(); i++)
+	{
+		SizeOutcome stripe_outcome = stripes[i].get();
+		if (!stripe_outcome.IsSuccess())
+		{
+			if (!failed)
+			{
+				failed_outcome = std::move(stripe_outcome);
+				failed = true;
+			}
+			continue;
+		}
+
+		// a short stripe means the end of the file was met, the data after it is not valid
+		if (contiguous)
+		{
+			bytes_read += stripe_outcome.GetResult();
+			contiguous = stripe_outcome.GetResult() == stripe_lengths[i];
+		}
+	}
+
+	if (failed)
+	{
+		return failed_outcome;
+	}
+	return bytes_read;
+}
+
+// Multifiles made of many small parts are read ahead one whole part per block, so that the parts are downloaded
+// concurrently instead of one after the other inside a block
+bool HasSmallParts(const MultiPartFile& multifile)
+{
+	const size_t part_count = multifile.layout_->parts_.size();
+	return part_count > 1 && read_config.small_part_size_ > 0 &&
+	       multifile.total_size_ / static_cast<tOffset>(part_count) < read_config.small_part_size_;
+}
+
+tOffset GetReadAheadBlockEnd(const MultiPartFile& multifile, tOffset block_start, bool small_parts)
+{
+	const tOffset block_end = std::min(block_start + read_config.block_size_, multifile.total_size_);
+	if (!small_parts)
+	{
+		return block_end;
+	}
+	const auto& cumul_sizes = multifile.layout_->cumulative_sizes_;
+	const auto part_end_it = std::upper_bound(cumul_sizes.begin(), cumul_sizes.end(), block_start);
+	return part_end_it == cumul_sizes.end() ? block_end : std::min(block_end, *part_end_it);
+}
+
+// Request in the background the blocks following the last one of the window, so that the window
+// covers the bytes up to read_end plus the configured number of blocks
+void ExtendReadAheadWindow(MultiPartFile& multifile, tOffset read_end)
+{
+	auto& blocks = multifile.read_ahead_.blocks_;
+	const tOffset block_size = read_config.block_size_;
+	// until the header check of a lazily opened multifile resolves, the total size is the size of the first part:
+	// the window does not go past it
+	const tOffset window_end = std::min(
+	    multifile.total_size_, read_end + static_cast<tOffset>(read_config.window_blocks_) * block_size);
+
+	// with small parts, the blocks are smaller: more of them are needed to keep the requests flowing
+	const bool small_parts = HasSmallParts(multifile);
+	const size_t max_blocks =
+	    small_parts ? std::max(read_config.window_blocks_, 4 * executor_pool_size) : std::numeric_limits<size_t>::max();
+
+	tOffset next_start = 0;
+	if (!blocks.empty())
+	{
+		next_start = blocks.back()->start_ + static_cast<tOffset>(blocks.back()->data_.size());
+	}
+	else if (small_parts || !multifile.first_block_.empty())
+	{
+		// aligning would fetch again the bytes before the offset
+		next_start = multifile.offset_;
+	}
+	else
+	{
+		next_start = (multifile.offset_ / block_size) * block_size;
+	}
+
+	const MultiPartFile* source = &multifile;
+	while (next_start < window_end && (blocks.size() < max_blocks || next_start < read_end))
+	{
+		ReadAheadBlockPtr block = Aws::MakeUnique<ReadAheadBlock>(KHIOPS_S3);
+		block->start_ = next_start;
+		block->data_.resize(static_cast<size_t>(GetReadAheadBlockEnd(multifile, next_start, small_parts) - next_start));
+		next_start += static_cast<tOffset>(block->data_.size());
+
+		ReadAheadBlock* target = block.get();
+		block->download_ = SubmitTask(
+				       [source, target]()
+				       {
+					       return ReadMultifileRange(*source, target->start_, target->data_.data(),
+									 static_cast<tOffset>(target->data_.size()));
+				       })
+				       .share();
+		spdlog::debug("read-ahead of block @ {}", block->start_);
+		blocks.push_back(std::move(block));
+	}
+}
+
+// Serve a sequential read from the read-ahead window, waiting for the blocks still in flight
+SizeOutcome ReadFromReadAheadWindow(MultiPartFile& multifile, unsigned char* buffer, tOffset to_read)
+{
+	auto& window = multifile.read_ahead_;
+	auto& blocks = window.blocks_;
+	const tOffset offset = multifile.offset_;
+	const tOffset read_end = offset + to_read;
+
+	// forget the blocks already consumed
+	while (!blocks.empty() && blocks.front()->start_ + static_cast<tOffset>(blocks.front()->data_.size()) <= offset)
+	{
+		blocks.front()->download_.wait();
+		blocks.pop_front();
+	}
+	if (!blocks.empty() && blocks.front()->start_ > offset)
+	{
+		window.Clear();
+	}
+
+	ExtendReadAheadWindow(multifile, read_end);
+
+	tOffset pos = offset;
+	for (const auto& block : blocks)
+	{
+		if (pos >= read_end)
+		{
+			break;
+		}
+
+		const SizeOutcome& download_outcome = block->download_.get();
+		if (!download_outcome.IsSuccess())
+		{
+			// let a later read retry the download
+			const SimpleError error = download_outcome.GetError();
+			window.Clear();
+			return error;
+		}
+
+		const tOffset block_end = block->start_ + download_outcome.GetResult();
+		const tOffset copy_count = std::min(block_end, read_end) - pos;
+		if (copy_count <= 0)
+		{
+			// the object is shorter than expected
+			break;
+		}
+		std::copy_n(block->data_.data() + (pos - block->start_), copy_count, buffer + (pos - offset));
+		pos += copy_count;
+	}
+
+	return pos - offset;
+}
+
+// Streaming reads
+
+size_t StreamPipe::Read(unsigned char* dest, size_t count)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	cond_.wait(lock, [this]() { return size_ > 0 || finished_ || cancelled_; });
+
+	const size_t to_copy = std::min(count, size_);
+	for (size_t copied = 0; copied < to_copy;)
+	{
+		const size_t chunk = std::min(to_copy - copied, data_.size() - head_);
+		std::copy(data_.begin() + static_cast<std::ptrdiff_t>(head_),
+			  data_.begin() + static_cast<std::ptrdiff_t>(head_ + chunk), dest + copied);
+		head_ = (head_ + chunk) % data_.size();
+		copied += chunk;
+	}
+	size_ -= to_copy;
+	cond_.notify_all();
+	return to_copy;
+}
+
+void StreamPipe::Cancel()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	cancelled_ = true;
+	cond_.notify_all();
+}
+
+bool StreamPipe::IsCancelled() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return cancelled_;
+}
+
+bool StreamPipe::StartResponse()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	diverted_ = false;
+	diverted_data_.clear();
+	diverted_read_ = 0;
+	setg(nullptr, nullptr, nullptr);
+	return !body_written_;
+}
+
+void StreamPipe::Divert()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	diverted_ = true;
+	diverted_data_.clear();
+	diverted_read_ = 0;
+	setg(nullptr, nullptr, nullptr);
+}
+
+void StreamPipe::Finish()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	finished_ = true;
+	cond_.notify_all();
+}
+
+StreamPipe::int_type StreamPipe::overflow(int_type c)
+{
+	if (traits_type::eq_int_type(c, traits_type::eof()))
+	{
+		return traits_type::not_eof(c);
+	}
+	const char ch = traits_type::to_char_type(c);
+	return xsputn(&ch, 1) == 1 ? c : traits_type::eof();
+}
+
+std::streamsize StreamPipe::xsputn(const char* s, std::streamsize count)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	if (diverted_)
+	{
+		diverted_data_.append(s, static_cast<size_t>(count));
+		return count;
+	}
+	body_written_ = body_written_ || count > 0;
+	std::streamsize written{0};
+	while (written < count)
+	{
+		cond_.wait(lock, [this]() { return size_ < data_.size() || cancelled_; });
+		if (cancelled_)
+		{
+			break;
+		}
+		const size_t tail = (head_ + size_) % data_.size();
+		const size_t chunk = std::min({static_cast<size_t>(count - written), data_.size() - size_,
+					       data_.size() - tail});
+		std::copy(s + written, s + written + static_cast<std::streamsize>(chunk),
+			  data_.begin() + static_cast<std::ptrdiff_t>(tail));
+		size_ += chunk;
+		written += static_cast<std::streamsize>(chunk);
+		cond_.notify_all();
+	}
+	return written;
+}
+
+// only a diverted body can be read back, the data passed on belongs to the consumer
+StreamPipe::int_type StreamPipe::underflow()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (!diverted_ || diverted_read_ >= diverted_data_.size())
+	{
+		return traits_type::eof();
+	}
+	char* begin = &diverted_data_[0];
+	setg(begin + diverted_read_, begin + diverted_read_, begin + diverted_data_.size());
+	diverted_read_ = diverted_data_.size();
+	return traits_type::to_int_type(*gptr());
+}
+
+void SequentialStream::Close()
+{
+	if (!pipe_)
+	{
+		return;
+	}
+	pipe_->Cancel();
+	if (download_.valid())
+	{
+		download_.wait();
+	}
+	download_ = std::future<SizeOutcome>();
+	pipe_.reset();
+	open_streams--;
+}
+
+void SwapStreams(SequentialStream& first, SequentialStream& second)
+{
+	std::swap(first.offset_, second.offset_);
+	std::swap(first.end_, second.end_);
+	first.pipe_.swap(second.pipe_);
+	std::swap(first.download_, second.download_);
+}
+
+// Start a GET from the offset to the end of the part containing it. Returns false if too many streams are open.
+bool OpenSequentialStream(const MultiPartFile& multifile, SequentialStream& stream, tOffset offset)
+{
+	size_t current_streams = open_streams.load();
+	do
+	{
+		if (current_streams >= read_config.streaming_reads_)
+		{
+			return false;
+		}
+	} while (!open_streams.compare_exchange_weak(current_streams, current_streams + 1));
+
+	const auto& cumul_sizes = multifile.layout_->cumulative_sizes_;
+	const size_t part = static_cast<size_t>(
+	    std::distance(cumul_sizes.begin(), std::upper_bound(cumul_sizes.begin(), cumul_sizes.end(), offset)));
+	const tOffset part_start = part == 0 ? offset : offset - cumul_sizes[part - 1] + multifile.layout_->common_header_length_;
+	const tOffset part_end = GetPartSize(multifile, part) - 1;
+
+	stream.offset_ = offset;
+	stream.end_ = cumul_sizes[part];
+	stream.pipe_ = Aws::MakeShared<StreamPipe>(KHIOPS_S3, static_cast<size_t>(read_config.block_size_));
+
+	spdlog::debug("streaming part {} from {}", part, part_start);
+
+	// the download runs on its own thread: it blocks while the reader does not consume, a pool thread could be
+	// needed by the reader itself
+	const Aws::String bucket = multifile.bucketname_;
+	const Aws::String object = multifile.layout_->parts_.GetKey(part);
+	const Aws::String etag = multifile.layout_->parts_.GetETag(part);
+	const std::shared_ptr<StreamPipe> pipe = stream.pipe_;
+	stream.download_ = std::async(
+	    std::launch::async,
+	    [bucket, object, etag, part_start, part_end, pipe]() -> SizeOutcome
+	    {
+		    auto request = MakeGetObjectRequest(bucket, object, MakeByteRange(part_start, part_end));
+		    if (!etag.empty())
+		    {
+			    request.SetIfMatch(etag);
+		    }
+		    request.SetResponseStreamFactory(
+			[pipe]()
+			{
+				if (!pipe->StartResponse())
+				{
+					pipe->Cancel();
+				}
+				return Aws::New<Aws::IOStream>(KHIOPS_S3, pipe.get());
+			});
+		    request.SetHeadersReceivedEventHandler(
+			[pipe](const Aws::Http::HttpRequest*, Aws::Http::HttpResponse* response)
+			{
+				if (!CarriesRequestedRange(*response))
+				{
+					pipe->Divert();
+				}
+			});
+		    request.SetContinueRequestHandler([pipe](const Aws::Http::HttpRequest*)
+						      { return !pipe->IsCancelled(); });
+
+		    auto outcome = client->GetObject(request);
+		    if (outcome.IsSuccess())
+		    {
+			    Aws::S3::Model::GetObjectResult result{outcome.GetResultWithOwnership()};
+			    auto& body = result.GetBody();
+			    if (body.rdbuf() != pipe.get())
+			    {
+				    // the body did not come through the factory, copy it
+				    std::ostream to_pipe(pipe.get());
+				    to_pipe << body.rdbuf();
+			    }
+		    }
+		    pipe->Finish();
+		    RETURN_OUTCOME_ON_ERROR(outcome);
+		    return part_end - part_start + 1;
+	    });
+	return true;
+}
+
+// Read from the streaming GET of the reader, opened at the current offset if needed
+SizeOutcome ReadFromSequentialStream(MultiPartFile& multifile, unsigned char* buffer, tOffset to_read)
+{
+	auto& stream = multifile.stream_;
+	auto& next_stream = multifile.next_part_stream_;
+	tOffset bytes_read{0};
+	while (bytes_read < to_read && multifile.offset_ + bytes_read < multifile.total_size_)
+	{
+		const tOffset offset = multifile.offset_ + bytes_read;
+		if (stream.IsOpen() && (stream.offset_ != offset || stream.offset_ == stream.end_))
+		{
+			stream.Close();
+		}
+		if (next_stream.IsOpen() && next_stream.offset_ < offset)
+		{
+			next_stream.Close();
+		}
+		if (!stream.IsOpen() && next_stream.IsOpen() && next_stream.offset_ == offset)
+		{
+			// the boundary is crossed, the next part is already on its way
+			SwapStreams(stream, next_stream);
+		}
+		if (!stream.IsOpen() && !OpenSequentialStream(multifile, stream, offset))
+		{
+			// no stream available, the rest is read with ranged requests
+			const auto range_outcome =
+			    ReadMultifileRange(multifile, offset, buffer + bytes_read, to_read - bytes_read);
+			PASS_OUTCOME_ON_ERROR(range_outcome);
+			return bytes_read + range_outcome.GetResult();
+		}
+
+		const size_t wanted = static_cast<size_t>(std::min(to_read - bytes_read, stream.end_ - offset));
+		const size_t read = stream.pipe_->Read(buffer + bytes_read, wanted);
+		if (read == 0)
+		{
+			// the download stopped before the end of the part, failed or not: the rest is read with ranged requests
+			const SizeOutcome download_outcome = stream.download_.get();
+			stream.Close();
+			if (!download_outcome.IsSuccess())
+			{
+				spdlog::debug("streaming GET failed @ {}: {}", offset, download_outcome.GetError().GetMessage());
+			}
+			const auto range_outcome =
+			    ReadMultifileRange(multifile, offset, buffer + bytes_read, to_read - bytes_read);
+			PASS_OUTCOME_ON_ERROR(range_outcome);
+			return bytes_read + range_outcome.GetResult();
+		}
+		bytes_read += static_cast<tOffset>(read);
+		stream.offset_ += static_cast<tOffset>(read);
+
+		// near the end of the part, the beginning of the next one is requested in the background
+		if (read_config.part_prefetch_distance_ > 0 && !next_stream.IsOpen() &&
+		    stream.end_ < multifile.total_size_ && stream.end_ - stream.offset_ <= read_config.part_prefetch_distance_)
+		{
+			OpenSequentialStream(multifile, next_stream, stream.end_);
+		}
+	}
+	return bytes_read;
+}
+
+// Random reads
+
+// Serve a non sequential read from the data fetched around the previous one, or fetch a new window. Nearby reads
+// are then coalesced in a single request.
+SizeOutcome ReadFromRandomAccessWindow(MultiPartFile& multifile, unsigned char* buffer, tOffset to_read)
+{
+	auto& window = multifile.random_access_;
+	const tOffset offset = multifile.offset_;
+	const tOffset window_end = window.start_ + static_cast<tOffset>(window.data_.size());
+
+	if (offset >= window.start_ && offset + to_read <= window_end)
+	{
+		const auto copy_start = window.data_.begin() + static_cast<std::ptrdiff_t>(offset - window.start_);
+		std::copy(copy_start, copy_start + static_cast<std::ptrdiff_t>(to_read), buffer);
+		return to_read;
+	}
+
+	// adapt the fetch size to the distance between the random reads
+	if (window.fetch_size_ == 0)
+	{
+		window.fetch_size_ = read_config.random_min_fetch_;
+	}
+	else if (!window.data_.empty() && offset + to_read > window.start_ - window.fetch_size_ &&
+		 offset < window_end + window.fetch_size_)
+	{
+		window.fetch_size_ = std::min(2 * window.fetch_size_, read_config.random_max_fetch_);
+	}
+	else
+	{
+		window.fetch_size_ = std::max(window.fetch_size_ / 2, read_config.random_min_fetch_);
+	}
+
+	if (to_read >= window.fetch_size_)
+	{
+		return ReadMultifileRangeStriped(multifile, offset, buffer, to_read);
+	}
+
+	const tOffset fetch_size = std::min(window.fetch_size_, multifile.total_size_ - offset);
+	spdlog::debug("random read of {} bytes @ {}, fetching {} bytes", to_read, offset, fetch_size);
+	window.data_.resize(static_cast<size_t>(fetch_size));
+	window.start_ = offset;
+	const auto fetch_outcome = ReadMultifileRange(multifile, offset, window.data_.data(), fetch_size);
+	if (!fetch_outcome.IsSuccess())
+	{
+		window.data_.clear();
+		return fetch_outcome;
+	}
+	window.data_.resize(static_cast<size_t>(fetch_outcome.GetResult()));
+
+	const tOffset copy_count = std::min(to_read, static_cast<tOffset>(window.data_.size()));
+	std::copy(window.data_.begin(), window.data_.begin() + static_cast<std::ptrdiff_t>(copy_count), buffer);
+	return copy_count;
+}
+
+bool IsDownloaded(const ReadAheadBlock& block)
+{
+	return block.download_.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+// Drop the oldest prefetched blocks whose download is over until the length fits in the budget. The blocks still
+// downloading are kept. Returns false if they hold too much of the budget.
+bool MakeRoomInPrefetched(PrefetchedRanges& prefetched, tOffset length, tOffset budget)
+{
+	for (auto it = prefetched.blocks_.begin(); it != prefetched.blocks_.end() && prefetched.size_ + length > budget;)
+	{
+		if (IsDownloaded(**it))
+		{
+			prefetched.size_ -= static_cast<tOffset>((*it)->data_.size());
+			it = prefetched.blocks_.erase(it);
+		}
+		else
+		{
+			it++;
+		}
 	}
-
-	return stream.gcount();
+	return prefetched.size_ + length <= budget;
 }
 
-SizeOutcome ReadBytesInFile(MultiPartFile& multifile, unsigned char* buffer, tOffset to_read)
+// Download in the background the blocks of [start, end) that are not prefetched yet. The oldest prefetched blocks
+// make room for them, and whatever does not fit in the budget is left out. Nothing here waits for a download.
+void PrefetchRange(MultiPartFile& multifile, tOffset start, tOffset end)
 {
-	// Start at first usable file chunk
-	// Advance through file chunks, advancing buffer pointer
-	// Until last requested byte was read
-	// Or error occured
+	auto& prefetched = multifile.prefetched_;
+	const tOffset budget = read_config.prefetch_budget_;
+	end = std::min(end, start + budget);
 
-	tOffset bytes_read{0};
+	const MultiPartFile* source = &multifile;
+	for (tOffset block_start = start; block_start < end;)
+	{
+		tOffset block_end = std::min(block_start + read_config.block_size_, end);
+		for (const auto& block : prefetched.blocks_)
+		{
+			const tOffset held_end = block->start_ + static_cast<tOffset>(block->data_.size());
+			if (block->start_ <= block_start && block_start < held_end)
+			{
+				block_end = block_start;
+				block_start = held_end;
+				break;
+			}
+			if (block_start < block->start_ && block->start_ < block_end)
+			{
+				block_end = block->start_;
+			}
+		}
+		if (block_end <= block_start)
+		{
+			continue;
+		}
 
-	// Lookup item containing initial bytes at requested offset
-	const auto& cumul_sizes = multifile.cumulative_sizes_;
-	const tOffset common_header_length = multifile.common_header_length_;
-	const Aws::String& bucket_name = multifile.bucketname_;
-	const auto& filenames = multifile.filenames_;
-	unsigned char* buffer_pos = buffer;
-	tOffset& offset = multifile.offset_;
-	const tOffset offset_bak = offset; // in case of irrecoverable error, leave the multifile in its starting state
+		const tOffset block_length = block_end - block_start;
+		if (!MakeRoomInPrefetched(prefetched, block_length, budget))
+		{
+			spdlog::debug("prefetch from {} skipped, the budget is held by downloads in flight", block_start);
+			return;
+		}
 
-	auto greater_than_offset_it = std::upper_bound(cumul_sizes.begin(), cumul_sizes.end(), offset);
-	size_t idx = static_cast<size_t>(std::distance(cumul_sizes.begin(), greater_than_offset_it));
+		ReadAheadBlockPtr block = Aws::MakeUnique<ReadAheadBlock>(KHIOPS_S3);
+		block->start_ = block_start;
+		block->data_.resize(static_cast<size_t>(block_length));
+		ReadAheadBlock* target = block.get();
+		block->download_ = SubmitTask(
+				       [source, target]()
+				       {
+					       return ReadMultifileRange(*source, target->start_, target->data_.data(),
+									 static_cast<tOffset>(target->data_.size()));
+				       })
+				       .share();
+		spdlog::debug("prefetch of {} bytes @ {}", block_length, block_start);
+		prefetched.size_ += block_length;
+		prefetched.blocks_.push_back(std::move(block));
+		block_start = block_end;
+	}
+}
 
-	spdlog::debug("Use item {} to read @ {} (end = {})", idx, offset, *greater_than_offset_it);
+// Release the data held for [start, end). The blocks still downloading are left to a later prefetch or to the close,
+// the advice does not wait for them.
+void DiscardRange(MultiPartFile& multifile, tOffset start, tOffset end)
+{
+	auto overlaps = [start, end](tOffset held_start, size_t held_size)
+	{ return held_start < end && start < held_start + static_cast<tOffset>(held_size); };
 
-	auto read_range_and_update = [&](const Aws::String& filename, tOffset start, tOffset end) -> SizeOutcome
+	auto& prefetched = multifile.prefetched_;
+	for (auto it = prefetched.blocks_.begin(); it != prefetched.blocks_.end();)
 	{
-		auto download_outcome = DownloadFileRangeToBuffer(
-		    bucket_name, filename, buffer_pos, static_cast<int64_t>(start), static_cast<int64_t>(end));
-		if (!download_outcome.IsSuccess())
+		if (overlaps((*it)->start_, (*it)->data_.size()) && IsDownloaded(**it))
 		{
-			offset = offset_bak;
-			return download_outcome.GetError();
+			prefetched.size_ -= static_cast<tOffset>((*it)->data_.size());
+			it = prefetched.blocks_.erase(it);
 		}
+		else
+		{
+			it++;
+		}
+	}
 
-		tOffset actual_read = download_outcome.GetResult();
-
-		spdlog::debug("read = {}", actual_read);
-
-		bytes_read += actual_read;
-		buffer_pos += actual_read;
-		offset += actual_read;
+	auto& window = multifile.read_ahead_;
+	const bool in_window = std::any_of(window.blocks_.begin(), window.blocks_.end(),
+					   [&](const ReadAheadBlockPtr& block)
+					   { return overlaps(block->start_, block->data_.size()); });
+	const bool window_downloaded = std::all_of(window.blocks_.begin(), window.blocks_.end(),
+						   [](const ReadAheadBlockPtr& block) { return IsDownloaded(*block); });
+	if (in_window && window_downloaded)
+	{
+		window.Clear();
+	}
+	if (overlaps(multifile.random_access_.start_, multifile.random_access_.data_.size()))
+	{
+		Aws::Vector<unsigned char>().swap(multifile.random_access_.data_);
+	}
+	if (overlaps(0, multifile.first_block_.size()))
+	{
+		Aws::Vector<unsigned char>().swap(multifile.first_block_);
+	}
+}
 
-		if (actual_read < (end - start + 1) /*expected read*/)
+// Copy the bytes of a read from the prefetched blocks, if they hold all of them. Blocks whose download failed are
+// dropped, the read then goes through the usual path.
+bool CopyFromPrefetched(MultiPartFile& multifile, unsigned char* buffer, tOffset to_read)
+{
+	auto& prefetched = multifile.prefetched_;
+	const tOffset offset = multifile.offset_;
+	tOffset pos = offset;
+	while (pos < offset + to_read)
+	{
+		const auto it = std::find_if(prefetched.blocks_.begin(), prefetched.blocks_.end(),
+					     [pos](const ReadAheadBlockPtr& block) {
+						     return block->start_ <= pos &&
+							    pos < block->start_ + static_cast<tOffset>(block->data_.size());
+					     });
+		if (it == prefetched.blocks_.end())
 		{
-			spdlog::debug("End of file encountered");
-			to_read = 0;
+			return false;
 		}
-		else
+
+		ReadAheadBlock& block = **it;
+		const SizeOutcome& download_outcome = block.download_.get();
+		if (!download_outcome.IsSuccess() || download_outcome.GetResult() < static_cast<tOffset>(block.data_.size()))
 		{
-			to_read -= actual_read;
+			prefetched.size_ -= static_cast<tOffset>(block.data_.size());
+			prefetched.blocks_.erase(it);
+			return false;
 		}
 
-		return actual_read;
-	};
+		const tOffset copy_count = std::min(offset + to_read, block.start_ + static_cast<tOffset>(block.data_.size())) - pos;
+		std::copy_n(block.data_.data() + (pos - block.start_), copy_count, buffer + (pos - offset));
+		pos += copy_count;
+	}
+	return true;
+}
 
-	// first file read
+SizeOutcome ReadBytesInFile(MultiPartFile& multifile, unsigned char* buffer, tOffset to_read)
+{
+	auto& window = multifile.read_ahead_;
 
-	// AWS peculiarity: byte ranges are inclusive
-	const tOffset file_start = (idx == 0) ? offset : offset - cumul_sizes[idx - 1] + common_header_length;
-	const tOffset read_end = std::min(file_start + to_read, file_start + cumul_sizes[idx] - offset) - 1;
+	// a read starting where the previous one ended is part of a sequential scan
+	if (multifile.offset_ == window.expected_offset_)
+	{
+		window.sequential_reads_++;
+	}
+	else
+	{
+		window.sequential_reads_ = 1;
+		window.Clear();
+		multifile.stream_.Close();
+		multifile.next_part_stream_.Close();
+	}
 
-	SizeOutcome read_outcome = read_range_and_update(filenames[idx], file_start, read_end);
+	bool sequential = window.sequential_reads_ >= read_config.sequential_reads_to_trigger_;
+	if (multifile.access_hint_ != AccessHint::kNormal)
+	{
+		sequential = multifile.access_hint_ == AccessHint::kSequential;
+	}
+	if (sequential && !multifile.random_access_.data_.empty())
+	{
+		Aws::Vector<unsigned char>().swap(multifile.random_access_.data_);
+	}
 
-	// continue with the next files
-	while (read_outcome.IsSuccess() && to_read)
+	auto& first_block = multifile.first_block_;
+	const tOffset first_block_size = static_cast<tOffset>(first_block.size());
+	if (first_block_size > 0 && multifile.offset_ >= first_block_size)
 	{
-		// read the missing bytes in the next files as necessary
-		idx++;
-		const tOffset start = common_header_length;
-		const tOffset end = std::min(start + to_read, start + cumul_sizes[idx] - cumul_sizes[idx - 1]) - 1;
+		Aws::Vector<unsigned char>().swap(first_block);
+	}
 
-		read_outcome = read_range_and_update(filenames[idx], start, end);
+	SizeOutcome read_outcome;
+	if (multifile.offset_ + to_read <= first_block_size)
+	{
+		// served by the bytes fetched on open
+		std::copy_n(first_block.data() + multifile.offset_, to_read, buffer);
+		read_outcome = to_read;
+	}
+	else if (!multifile.prefetched_.blocks_.empty() && CopyFromPrefetched(multifile, buffer, to_read))
+	{
+		read_outcome = to_read;
+	}
+	else if (sequential && read_config.streaming_reads_ > 0)
+	{
+		read_outcome = ReadFromSequentialStream(multifile, buffer, to_read);
+	}
+	else if (sequential && read_config.window_blocks_ > 0)
+	{
+		read_outcome = ReadFromReadAheadWindow(multifile, buffer, to_read);
+	}
+	else if (!sequential && read_config.random_min_fetch_ > 0 && multifile.access_hint_ != AccessHint::kRandom)
+	{
+		read_outcome = ReadFromRandomAccessWindow(multifile, buffer, to_read);
+	}
+	else
+	{
+		read_outcome = ReadMultifileRangeStriped(multifile, multifile.offset_, buffer, to_read);
 	}
 
 	if (read_outcome.IsSuccess())
 	{
-		read_outcome.GetResult() = bytes_read;
+		multifile.offset_ += read_outcome.GetResult();
+		window.expected_offset_ = multifile.offset_;
 	}
 
 	return read_outcome;
@@ -472,6 +2697,26 @@ Aws::String GetEnvironmentVariableOrDefault(const Aws::String& variable_name, co
   }
 }
 
+// Positive integer value of an environment variable, the default value is used if the variable
+// is not set or not valid
+long long GetEnvironmentVariableAsSizeOrDefault(const Aws::String& variable_name, long long default_value)
+{
+	const Aws::String value = GetEnvironmentVariableOrDefault(variable_name, "");
+	if (value.empty())
+	{
+		return default_value;
+	}
+
+	char* end = nullptr;
+	const long long parsed = std::strtoll(value.c_str(), &end, 10);
+	if (*end != '\0' || parsed < 0)
+	{
+		spdlog::warn("Invalid value {} for {}, using default {}", value, variable_name, default_value);
+		return default_value;
+	}
+	return parsed;
+}
+
 bool IsMultifile(const Aws::String& pattern, size_t& first_special_char_idx)
 {
 	spdlog::debug("Parse multifile pattern {}", pattern);
@@ -534,10 +2779,10 @@ Aws::S3::Model::ListObjectsV2Outcome ListObjects(const Aws::String& bucket, cons
 // Get from a bucket a list of objects matching a name pattern.
 // To get a limited list of objects to filter per request, the request includes a well defined
 // prefix contained in the pattern
-FilterOutcome FilterList(const Aws::String& bucket, const Aws::String& pattern, size_t pattern_1st_sp_char_pos)
+FilterOutcome ListMatchingObjects(const Aws::String& bucket, const Aws::String& pattern, size_t pattern_1st_sp_char_pos)
 {
-	ObjectsVec res;
-
+	auto res = Aws::MakeShared<ObjectList>(KHIOPS_S3);
+	const utils::GlobMatcher matcher{pattern};
 	Aws::S3::Model::ListObjectsV2Request request;
 	request.WithBucket(bucket).WithPrefix(pattern.substr(0, pattern_1st_sp_char_pos)); //.WithDelimiter("");
 	Aws::String continuation_token;
@@ -553,20 +2798,40 @@ FilterOutcome FilterList(const Aws::String& bucket, const Aws::String& pattern,
 		RETURN_OUTCOME_ON_ERROR(outcome);
 
 		const auto& list_result = outcome.GetResult();
-		const auto& objects = list_result.GetContents();
-		std::copy_if(objects.begin(), objects.end(), std::back_inserter(res),
-			     [&](const S3Object& obj) { return utils::gitignore_glob_match(obj.GetKey(), pattern); });
+		// only the name, size and version of the matching objects are kept
+		for (const S3Object& obj : list_result.GetContents())
+		{
+			if (matcher.Match(obj.GetKey()))
+			{
+				res->Append(obj.GetKey(), obj.GetSize(), obj.GetETag());
+			}
+		}
 		continuation_token = list_result.GetContinuationToken();
 
 	} while (!continuation_token.empty());
 
-	return res;
+	ObjectListPtr listing{std::move(res)};
+	list_cache.Insert(MakeMetadataCacheKey(bucket, pattern), listing);
+	return listing;
+}
+
+// Cached listing, concurrent identical listings are made once
+FilterOutcome FilterList(const Aws::String& bucket, const Aws::String& pattern, size_t pattern_1st_sp_char_pos)
+{
+	const Aws::String cache_key = MakeMetadataCacheKey(bucket, pattern);
+	ObjectListPtr cached;
+	if (list_cache.Lookup(cache_key, cached))
+	{
+		return cached;
+	}
+
+	return list_flights.Do(cache_key, [&]() { return ListMatchingObjects(bucket, pattern, pattern_1st_sp_char_pos); });
 }
 
 #define KH_S3_FILTER_LIST(var, bucket, pattern, pattern_1st_sp_char_pos)                                               \
 	const auto var##_outcome = FilterList(bucket, pattern, pattern_1st_sp_char_pos);                               \
 	PASS_OUTCOME_ON_ERROR(var##_outcome);                                                                          \
-	const ObjectsVec& var = var##_outcome.GetResult();
+	const ObjectList& var = *var##_outcome.GetResult();
 
 #define KH_S3_EMPTY_LIST(list)                                                                                         \
 	if ((list).empty())                                                                                            \
@@ -580,6 +2845,11 @@ bool WillSizeCountProductOverflow(size_t size, size_t count)
 	return (max_prod_usable / size < count || max_prod_usable / count < size);
 }
 
+bool IsUploadStarted(const Writer& writer)
+{
+	return !writer.writer_.GetUploadId().empty();
+}
+
 template <typename Request> Request MakeBaseUploadRequest(const Writer& writer)
 {
 	const auto& multipartupload_data = writer.writer_;
@@ -668,6 +2938,58 @@ int driver_connect()
 
 	spdlog::debug("Connect {}", loglevel);
 
+	// Tuning of the background reads
+	const ReadConfig read_defaults;
+	executor_pool_size = static_cast<size_t>(std::max(
+	    1LL, GetEnvironmentVariableAsSizeOrDefault("S3_DRIVER_MAX_PARALLEL_REQUESTS", kDefaultParallelRequests)));
+	read_config.block_size_ = std::max(
+	    1LL, GetEnvironmentVariableAsSizeOrDefault("S3_DRIVER_READAHEAD_BLOCK_SIZE", read_defaults.block_size_));
+	read_config.window_blocks_ = static_cast<size_t>(GetEnvironmentVariableAsSizeOrDefault(
+	    "S3_DRIVER_READAHEAD_BLOCKS", static_cast<long long>(read_defaults.window_blocks_)));
+	read_config.stripe_size_ =
+	    GetEnvironmentVariableAsSizeOrDefault("S3_DRIVER_STRIPE_SIZE", read_defaults.stripe_size_);
+	read_config.cache_size_ = static_cast<size_t>(GetEnvironmentVariableAsSizeOrDefault(
+	    "S3_DRIVER_CACHE_SIZE", static_cast<long long>(read_defaults.cache_size_)));
+	read_config.cache_block_size_ = std::max(
+	    1LL, GetEnvironmentVariableAsSizeOrDefault("S3_DRIVER_CACHE_BLOCK_SIZE", read_defaults.cache_block_size_));
+	read_config.cache_dir_ = GetEnvironmentVariableOrDefault("S3_DRIVER_CACHE_DIR", "");
+	read_config.cache_dir_size_ = static_cast<size_t>(GetEnvironmentVariableAsSizeOrDefault(
+	    "S3_DRIVER_CACHE_DIR_SIZE", static_cast<long long>(read_defaults.cache_dir_size_)));
+	read_config.lazy_open_ = GetEnvironmentVariableAsSizeOrDefault("S3_DRIVER_LAZY_OPEN", 0) != 0;
+	read_config.streaming_reads_ = static_cast<size_t>(GetEnvironmentVariableAsSizeOrDefault(
+	    "S3_DRIVER_STREAMING_READS", static_cast<long long>(read_defaults.streaming_reads_)));
+	read_config.random_min_fetch_ =
+	    GetEnvironmentVariableAsSizeOrDefault("S3_DRIVER_RANDOM_MIN_FETCH", read_defaults.random_min_fetch_);
+	read_config.random_max_fetch_ = std::max(
+	    read_config.random_min_fetch_,
+	    GetEnvironmentVariableAsSizeOrDefault("S3_DRIVER_RANDOM_MAX_FETCH", read_defaults.random_max_fetch_));
+	read_config.part_prefetch_distance_ = GetEnvironmentVariableAsSizeOrDefault(
+	    "S3_DRIVER_PART_PREFETCH_DISTANCE", read_defaults.part_prefetch_distance_);
+	read_config.open_fetch_size_ =
+	    GetEnvironmentVariableAsSizeOrDefault("S3_DRIVER_OPEN_FETCH_SIZE", read_defaults.open_fetch_size_);
+	read_config.hedge_percentile_ = static_cast<size_t>(std::min(
+	    100LL, std::max(0LL, GetEnvironmentVariableAsSizeOrDefault("S3_DRIVER_HEDGE_PERCENTILE",
+								      static_cast<long long>(read_defaults.hedge_percentile_)))));
+	read_config.hedge_min_delay_ms_ =
+	    GetEnvironmentVariableAsSizeOrDefault("S3_DRIVER_HEDGE_MIN_DELAY_MS", read_defaults.hedge_min_delay_ms_);
+	read_config.prefetch_budget_ =
+	    GetEnvironmentVariableAsSizeOrDefault("S3_DRIVER_PREFETCH_BUDGET", read_defaults.prefetch_budget_);
+	read_config.readv_merge_gap_ =
+	    GetEnvironmentVariableAsSizeOrDefault("S3_DRIVER_READV_MERGE_GAP", read_defaults.readv_merge_gap_);
+	read_config.readv_max_run_ =
+	    GetEnvironmentVariableAsSizeOrDefault("S3_DRIVER_READV_MAX_RUN", read_defaults.readv_max_run_);
+	read_config.small_part_size_ =
+	    GetEnvironmentVariableAsSizeOrDefault("S3_DRIVER_SMALL_PART_SIZE", read_defaults.small_part_size_);
+	read_config.metadata_ttl_ms_ =
+	    GetEnvironmentVariableAsSizeOrDefault("S3_DRIVER_METADATA_CACHE_TTL_MS", read_defaults.metadata_ttl_ms_);
+	ConfigureDiskCache();
+	block_cache.Clear();
+	block_cache.SetBudget(read_config.cache_size_);
+	ConfigureMetadataCaches();
+	spdlog::debug("Read-ahead: {} blocks of {} bytes, stripes of {} bytes, {} parallel requests",
+		      read_config.window_blocks_, read_config.block_size_, read_config.stripe_size_,
+		      executor_pool_size);
+
 	// Configuration: we honor both standard AWS config files and environment
 	// variables If both configuration files and environment variables are set
 	// precedence is given to environment variables
@@ -767,6 +3089,15 @@ int driver_connect()
 		!GetEnvironmentVariableOrDefault("S3_ALLOW_SYSTEM_PROXY", "").empty();
 	clientConfig.verifySSL = true;
 	clientConfig.version = Aws::Http::Version::HTTP_VERSION_2TLS;
+	clientConfig.maxConnections = std::max(
+	    clientConfig.maxConnections,
+	    static_cast<unsigned>(executor_pool_size + read_config.streaming_reads_ + 1));
+	// transfers slower than the limit during the low-speed time are aborted, then resumed
+	clientConfig.lowSpeedLimit = static_cast<unsigned long>(std::max(
+	    0LL, GetEnvironmentVariableAsSizeOrDefault("S3_DRIVER_LOW_SPEED_LIMIT",
+						       static_cast<long long>(clientConfig.lowSpeedLimit))));
+	clientConfig.requestTimeoutMs = static_cast<long>(GetEnvironmentVariableAsSizeOrDefault(
+	    "S3_DRIVER_LOW_SPEED_TIME_MS", static_cast<long long>(clientConfig.requestTimeoutMs)));
 	if (s3endpoint != "")
 	{
 		clientConfig.endpointOverride = std::move(s3endpoint);
@@ -798,6 +3129,11 @@ int driver_disconnect()
 		for (auto h_it = active_writer_handles.begin(); h_it != active_writer_handles.end();)
 		{
 			auto& writer = **h_it;
+			if (!IsUploadStarted(writer))
+			{
+				h_it = active_writer_handles.erase(h_it);
+				continue;
+			}
 			auto outcome = client->AbortMultipartUpload(
 			    MakeBaseUploadRequest<Aws::S3::Model::AbortMultipartUploadRequest>(writer));
 
@@ -827,8 +3163,22 @@ int driver_disconnect()
 		}
 	}
 
-	active_writer_handles.clear();
-	active_reader_handles.clear();
+	WaitPendingReads(nullptr);
+	pending_reads.clear();
+	{
+		std::lock_guard<std::mutex> lock(handles_mutex);
+		active_writer_handles.clear();
+		active_reader_handles.clear();
+	}
+
+	// no more background work once the handles are gone, transfers still running such as the losers of hedged
+	// GETs are aborted rather than waited for
+	if (client)
+	{
+		client->DisableRequestProcessing();
+	}
+	executor.reset();
+	block_cache.Clear();
 
 	client.reset();
 	
@@ -909,7 +3259,7 @@ int driver_fileExists(const char* sFilePathName)
 	auto filter_list_outcome = FilterList(names.bucket_, names.object_, pattern_1st_sp_char_pos);
 	RETURN_ON_ERROR(filter_list_outcome, "Error while filtering object list", kFalse);
 
-	return filter_list_outcome.GetResult().empty() ? kFalse : kTrue;
+	return filter_list_outcome.GetResult()->empty() ? kFalse : kTrue;
 }
 
 int driver_dirExists(const char* sFilePathName)
@@ -930,22 +3280,41 @@ SizeOutcome GetOneFileSize(const Aws::String& bucket, const Aws::String& object)
 	return head_object_outcome.GetResult().GetContentLength();
 }
 
-SimpleOutcome<Aws::String> ReadHeader(const Aws::String& bucket, const S3Object& obj)
+// Read the first line of the object using ranged requests. The probe grows until a newline is found, so that only
+// the beginning of the object is transferred. The metadata of the object comes with the first probe.
+SimpleOutcome<Aws::String> ReadHeader(const Aws::String& bucket, const ListedObject& obj, Metadata* metadata = nullptr)
 {
-	auto request = MakeGetObjectRequest(bucket, obj.GetKey());
-	auto outcome = client->GetObject(request);
-	RETURN_OUTCOME_ON_ERROR(outcome);
-	auto result = outcome.GetResultWithOwnership();
-	Aws::IOStream& read_stream = result.GetBody();
+	constexpr tOffset initial_probe_size{64 * 1024};
+
+	const tOffset object_size = obj.GetSize();
 	Aws::String line;
-	std::getline(read_stream, line);
-	if (read_stream.bad())
-	{
-		return MakeSimpleError(Aws::S3::S3Errors::INTERNAL_FAILURE, "header read failed");
-	}
-	if (!read_stream.eof())
+	tOffset probe_size = initial_probe_size;
+	while (static_cast<tOffset>(line.size()) < object_size)
 	{
-		line.push_back('\n');
+		const size_t start = line.size();
+		const tOffset end = std::min(static_cast<tOffset>(start) + probe_size, object_size) - 1;
+		line.resize(static_cast<size_t>(end) + 1);
+		Aws::Vector<BufferSegment> segments{
+		    BufferSegment{reinterpret_cast<unsigned char*>(&line[start]), line.size() - start}};
+		const auto download_outcome =
+		    DownloadFileRangeToSegments(bucket, obj.GetKey(), std::move(segments), static_cast<int64_t>(start),
+						static_cast<int64_t>(end), obj.GetETag(), start == 0 ? metadata : nullptr);
+		PASS_OUTCOME_ON_ERROR(download_outcome);
+		const size_t read = static_cast<size_t>(download_outcome.GetResult());
+		line.resize(start + read);
+
+		const size_t newline_pos = line.find('\n', start);
+		if (newline_pos != Aws::String::npos)
+		{
+			line.resize(newline_pos + 1);
+			break;
+		}
+		if (read < static_cast<size_t>(end) + 1 - start)
+		{
+			// end of file
+			break;
+		}
+		probe_size *= 2;
 	}
 	if (line.empty())
 	{
@@ -954,10 +3323,203 @@ SimpleOutcome<Aws::String> ReadHeader(const Aws::String& bucket, const S3Object&
 	return line;
 }
 
-#define KH_S3_READ_HEADER(var, bucket, obj)                                                                            \
-	const auto var##_outcome = ReadHeader((bucket), (obj));                                                        \
-	PASS_OUTCOME_ON_ERROR(var##_outcome);                                                                          \
-	const Aws::String& var = var##_outcome.GetResult();
+// Header description stored as metadata by the driver's writers, empty if the object has none
+Metadata MakeHeaderMetadata(const Aws::String& header)
+{
+	Metadata metadata;
+	metadata[kHeaderLengthMetadata] = std::to_string(header.size());
+	// the metadata replaces the comparison of the bytes, the digest has to resist collisions
+	metadata[kHeaderHashMetadata] =
+	    Aws::Utils::HashingUtils::HexEncode(Aws::Utils::HashingUtils::CalculateSHA256(header));
+	return metadata;
+}
+
+bool HasHeaderMetadata(const Metadata& metadata)
+{
+	return metadata.count(kHeaderLengthMetadata) > 0 && metadata.count(kHeaderHashMetadata) > 0;
+}
+
+Metadata GetHeaderMetadata(const Metadata& metadata)
+{
+	Metadata header_metadata;
+	if (HasHeaderMetadata(metadata))
+	{
+		header_metadata[kHeaderLengthMetadata] = metadata.at(kHeaderLengthMetadata);
+		header_metadata[kHeaderHashMetadata] = metadata.at(kHeaderHashMetadata);
+	}
+	return header_metadata;
+}
+
+// Check that the object starts with the given header. The listing is used first: a part smaller than the header
+// cannot start with it and a part with the same ETag as the first one has the same content. When the dataset was
+// written by the driver, the metadata of the object is enough. Otherwise exactly the length of the header is
+// downloaded and compared.
+SimpleOutcome<bool> IsHeaderOf(const Aws::String& bucket, const ListedObject& obj, const Aws::String& header,
+			       const Aws::String& header_etag, bool use_metadata)
+{
+	const tOffset header_size = static_cast<tOffset>(header.size());
+	if (obj.GetSize() < header_size)
+	{
+		return false;
+	}
+	// without a trailing newline, the header is the whole first file
+	if (header.back() != '\n' && obj.GetSize() != header_size)
+	{
+		return false;
+	}
+	if (!header_etag.empty() && obj.GetETag() == header_etag)
+	{
+		return true;
+	}
+	if (use_metadata)
+	{
+		const auto head_outcome = HeadObject(bucket, obj.GetKey());
+		RETURN_OUTCOME_ON_ERROR(head_outcome);
+		const Metadata& metadata = head_outcome.GetResult().GetMetadata();
+		if (HasHeaderMetadata(metadata))
+		{
+			return GetHeaderMetadata(metadata) == MakeHeaderMetadata(header);
+		}
+	}
+
+	Aws::String start(header.size(), '\0');
+	Aws::Vector<BufferSegment> segments{BufferSegment{reinterpret_cast<unsigned char*>(&start[0]), start.size()}};
+	const auto download_outcome = DownloadFileRangeToSegments(bucket, obj.GetKey(), std::move(segments), 0,
+								  static_cast<int64_t>(header_size) - 1, obj.GetETag());
+	PASS_OUTCOME_ON_ERROR(download_outcome);
+	start.resize(static_cast<size_t>(download_outcome.GetResult()));
+	return start == header;
+}
+
+// Check that all the files of the list start with the given header, the first file excepted. The headers are checked
+// concurrently, at most one per thread of the pool at a time, a new check being submitted each time one completes.
+// The check stops at the first mismatch.
+SimpleOutcome<bool> HasSameHeaders(const Aws::String& bucket, const ObjectList& file_list, const Aws::String& header,
+				   bool use_metadata)
+{
+	const size_t window_size = std::max(executor_pool_size, size_t{1});
+	const Aws::String header_etag = file_list.GetETag(0);
+	auto mismatch_found = std::make_shared<std::atomic<bool>>(false);
+
+	Aws::Deque<std::future<SimpleOutcome<bool>>> checks;
+	SimpleOutcome<bool> result{true};
+	size_t next = 1;
+	while (next < file_list.size() || !checks.empty())
+	{
+		// keep the window full as long as no mismatch was found
+		while (next < file_list.size() && checks.size() < window_size && result.IsSuccess() && result.GetResult())
+		{
+			ListedObject curr_file = file_list.Get(next++);
+			checks.push_back(SubmitTask(
+			    [&bucket, &header, &header_etag, curr_file, use_metadata, mismatch_found]() -> SimpleOutcome<bool>
+			    {
+				    // a previous file already differs, no need for another request
+				    if (mismatch_found->load())
+				    {
+					    return false;
+				    }
+				    const auto same_header_outcome = IsHeaderOf(bucket, curr_file, header, header_etag, use_metadata);
+				    PASS_OUTCOME_ON_ERROR(same_header_outcome);
+				    const bool same_header = same_header_outcome.GetResult();
+				    if (!same_header)
+				    {
+					    mismatch_found->store(true);
+				    }
+				    return same_header;
+			    }));
+		}
+		if (checks.empty())
+		{
+			break;
+		}
+
+		// the tasks in flight are all waited for, since they reference the caller's data
+		SimpleOutcome<bool> check_outcome = checks.front().get();
+		checks.pop_front();
+		if (result.IsSuccess() && result.GetResult() && (!check_outcome.IsSuccess() || !check_outcome.GetResult()))
+		{
+			mismatch_found->store(true);
+			result = std::move(check_outcome);
+		}
+	}
+	return result;
+}
+
+// Length of the header repeated at the start of every file of the list, 0 if the files do not share their header
+SizeOutcome GetCommonHeaderLength(const Aws::String& bucket, const ObjectList& file_list)
+{
+	// the result holds as long as none of the parts changes
+	Aws::String cache_key{bucket};
+	for (size_t i = 0; i < file_list.size(); i++)
+	{
+		cache_key.push_back('\0');
+		cache_key.append(file_list.GetKey(i)).push_back('\0');
+		cache_key.append(file_list.GetETag(i));
+	}
+	tOffset cached_length{0};
+	if (header_length_cache.Lookup(cache_key, cached_length))
+	{
+		return cached_length;
+	}
+
+	// if the first file was written by the driver, the others probably were too and their metadata is checked first
+	Metadata first_metadata;
+	const auto header_outcome = ReadHeader(bucket, file_list.Get(0), &first_metadata);
+	PASS_OUTCOME_ON_ERROR(header_outcome);
+	const Aws::String& header = header_outcome.GetResult();
+
+	const auto same_header_outcome = HasSameHeaders(bucket, file_list, header, HasHeaderMetadata(first_metadata));
+	PASS_OUTCOME_ON_ERROR(same_header_outcome);
+	const tOffset common_header_length = same_header_outcome.GetResult() ? static_cast<tOffset>(header.size()) : 0;
+	header_length_cache.Insert(cache_key, common_header_length);
+	return common_header_length;
+}
+
+// Layout of the listed parts, with the offsets adjusted to the length of their common header
+FileLayout MakeMultifileLayout(const ObjectList& file_list, tOffset common_header_length)
+{
+	const size_t file_count = file_list.size();
+	FileLayout layout;
+	layout.common_header_length_ = common_header_length;
+	layout.parts_ = file_list;
+	layout.cumulative_sizes_.resize(file_count);
+
+	tOffset cumulative_size = 0;
+	for (size_t i = 0; i < file_count; i++)
+	{
+		cumulative_size += i == 0 ? file_list.GetSize(i) : file_list.GetSize(i) - common_header_length;
+		layout.cumulative_sizes_[i] = cumulative_size;
+	}
+	return layout;
+}
+
+// Apply the deferred header check of a lazily opened multifile to its offsets and size
+SizeOutcome ResolveCommonHeader(MultiPartFile& multifile)
+{
+	std::lock_guard<std::mutex> lock(multifile.header_mutex_);
+	if (!multifile.pending_layout_.valid())
+	{
+		return multifile.layout_->common_header_length_;
+	}
+
+	// on error, the check is kept so that later calls fail the same way
+	const auto layout_outcome = multifile.pending_layout_.get();
+	PASS_OUTCOME_ON_ERROR(layout_outcome);
+	multifile.pending_layout_ = std::shared_future<SimpleOutcome<FileLayoutPtr>>();
+
+	// The asynchronous reads, the read-ahead and the prefetched blocks in flight use the layout being replaced. The
+	// blocks were kept within the first part, whose offsets do not change: their data stays valid. The streaming
+	// GETs copied their object name and range when they started and do not read the layout.
+	WaitPendingReads(&multifile);
+	multifile.read_ahead_.Wait();
+	multifile.prefetched_.Wait();
+	multifile.layout_ = layout_outcome.GetResult();
+	multifile.total_size_ = multifile.layout_->cumulative_sizes_.back();
+
+	const tOffset common_header_length = multifile.layout_->common_header_length_;
+	spdlog::debug("header check of {} done, common header length {}", multifile.filename_, common_header_length);
+	return common_header_length;
+}
 
 SizeOutcome getFileSize(const Aws::String& bucket_name, const Aws::String& object_name)
 {
@@ -977,8 +3539,7 @@ SizeOutcome getFileSize(const Aws::String& bucket_name, const Aws::String& objec
 	KH_S3_EMPTY_LIST(file_list);
 
 	// get the size of the first file
-	const S3Object& first_file = file_list.front();
-	long long total_size = first_file.GetSize();
+	long long total_size = file_list.GetSize(0);
 
 	// special case: one element
 	if (file_list.size() == 1)
@@ -987,38 +3548,17 @@ SizeOutcome getFileSize(const Aws::String& bucket_name, const Aws::String& objec
 	}
 
 	// general case: more than one element
-	// read the size of the header
-
-	KH_S3_READ_HEADER(header, bucket_name, first_file); // !! puts header and outcome_header into scope
-
-	const size_t header_size = header.size();
-
-	// scan the next files and adjust effective size if header is repeated
-	int nb_headers_to_subtract = 0;
-	bool same_header = true;
-
+	// adjust effective size if header is repeated
 	for (size_t i = 1; i < file_list.size(); i++)
 	{
-		const S3Object& curr_file = file_list[i];
-		if (same_header)
-		{
-			KH_S3_READ_HEADER(curr_header, bucket_name,
-					  curr_file); // !! puts curr_header_outcome and curr_header into scope
-
-			same_header = (header == curr_header);
-			if (same_header)
-			{
-				nb_headers_to_subtract++;
-			}
-		}
-		total_size += curr_file.GetSize();
+		total_size += file_list.GetSize(i);
 	}
 
-	if (!same_header)
-	{
-		nb_headers_to_subtract = 0;
-	}
-	return total_size - static_cast<long long>(nb_headers_to_subtract * header_size);
+	const auto header_size_outcome = GetCommonHeaderLength(bucket_name, file_list);
+	PASS_OUTCOME_ON_ERROR(header_size_outcome);
+	const long long header_size = header_size_outcome.GetResult();
+	const long long nb_headers_to_subtract = static_cast<long long>(file_list.size()) - 1;
+	return total_size - nb_headers_to_subtract * header_size;
 }
 
 long long int driver_getFileSize(const char* filename)
@@ -1036,93 +3576,189 @@ long long int driver_getFileSize(const char* filename)
 	return maybe_file_size.GetResult();
 }
 
-SimpleOutcome<ReaderPtr> MakeReaderPtr(Aws::String bucketname, Aws::String objectname)
+// Total size of the object in the Content-Range of a ranged response ("bytes 0-99/1234"), -1 if unknown
+tOffset ParseContentRangeSize(const Aws::String& content_range)
+{
+	const size_t slash_pos = content_range.rfind('/');
+	if (slash_pos == Aws::String::npos)
+	{
+		return -1;
+	}
+	const char* digits = content_range.c_str() + slash_pos + 1;
+	char* digits_end = nullptr;
+	const long long size = std::strtoll(digits, &digits_end, 10);
+	return digits_end == digits || *digits_end != '\0' || size < 0 ? -1 : size;
+}
+
+// A ranged GET of the first bytes of an object also yields its size, which saves the HEAD request otherwise needed
+// to open it. Objects shorter than the range are fetched whole, and only empty objects, which have no range to serve,
+// need the HEAD request.
+SimpleOutcome<FirstBlock> FetchFirstBlock(const Aws::String& bucket, const Aws::String& object, tOffset length)
+{
+	FirstBlock first_block;
+	first_block.data_.resize(static_cast<size_t>(length));
+	SegmentedStreamBuf stream_buf{{BufferSegment{first_block.data_.data(), first_block.data_.size()}}};
+
+	auto request = MakeGetObjectRequest(bucket, object, MakeByteRange(0, length - 1));
+	request.SetResponseStreamFactory(
+	    [&stream_buf]()
+	    {
+		    stream_buf.Reset();
+		    return Aws::New<Aws::IOStream>(KHIOPS_S3, &stream_buf);
+	    });
+
+	auto outcome = client->GetObject(request);
+	if (!outcome.IsSuccess() &&
+	    outcome.GetError().GetResponseCode() == Aws::Http::HttpResponseCode::REQUESTED_RANGE_NOT_SATISFIABLE)
+	{
+		const auto head_outcome = HeadObject(bucket, object);
+		RETURN_OUTCOME_ON_ERROR(head_outcome);
+		first_block.data_.clear();
+		first_block.object_size_ = head_outcome.GetResult().GetContentLength();
+		first_block.etag_ = head_outcome.GetResult().GetETag();
+		return first_block;
+	}
+	RETURN_OUTCOME_ON_ERROR(outcome);
+
+	Aws::S3::Model::GetObjectResult result{outcome.GetResultWithOwnership()};
+	auto& stream = result.GetBody();
+	if (stream.rdbuf() != &stream_buf)
+	{
+		std::ostream to_segments(&stream_buf);
+		to_segments << stream.rdbuf();
+	}
+	if (stream.bad())
+	{
+		return MakeSimpleError(Aws::S3::S3Errors::INTERNAL_FAILURE, "Failed to read stream content");
+	}
+
+	const tOffset written = stream_buf.GetWrittenSize();
+	first_block.data_.resize(static_cast<size_t>(written));
+	first_block.object_size_ = ParseContentRangeSize(result.GetContentRange());
+	if (first_block.object_size_ < 0)
+	{
+		// without a range in the response, the body is the whole object if it fit
+		if (!result.GetContentRange().empty() || written >= length)
+		{
+			return MakeSimpleError(Aws::S3::S3Errors::INTERNAL_FAILURE, "Unknown size of object " + object);
+		}
+		first_block.object_size_ = written;
+	}
+	first_block.etag_ = result.GetETag();
+
+	// the response carries what a HEAD request would have returned
+	Aws::S3::Model::HeadObjectResult head_result;
+	head_result.SetContentLength(first_block.object_size_);
+	head_result.SetETag(first_block.etag_);
+	head_result.SetMetadata(result.GetMetadata());
+	head_cache.Insert(MakeMetadataCacheKey(bucket, object), Aws::S3::Model::HeadObjectOutcome(std::move(head_result)));
+
+	return first_block;
+}
+
+// Handles opening the same file at the same time share the fetch
+SimpleOutcome<FirstBlock> GetFirstBlock(const Aws::String& bucket, const Aws::String& object, tOffset length)
+{
+	Aws::String flight_key = MakeMetadataCacheKey(bucket, object);
+	flight_key.push_back('\0');
+	flight_key.append(std::to_string(length).c_str());
+	return first_block_flights.Do(flight_key, [&]() { return FetchFirstBlock(bucket, object, length); });
+}
+
+SimpleOutcome<ReaderPtr> MakeReaderPtr(Aws::String bucketname, Aws::String objectname, bool lazy = false)
 {
+	// the layouts are registered by file, and shared by the handles that listed the same parts
+	const Aws::String layout_key = MakeMetadataCacheKey(bucketname, objectname);
+
 	size_t pattern_1st_sp_char_pos = 0;
 	if (!IsMultifile(objectname, pattern_1st_sp_char_pos))
 	{
 		// create a Multifile with a single file
-		const auto size_outcome = GetOneFileSize(bucketname, objectname);
-		PASS_OUTCOME_ON_ERROR(size_outcome);
-		const long long size = size_outcome.GetResult();
+		auto make_layout = [&](tOffset size, const Aws::String& etag)
+		{
+			FileLayout layout;
+			layout.parts_.Append(objectname, size, etag);
+			layout.cumulative_sizes_.push_back(size);
+			return layout_registry.Intern(layout_key, std::move(layout));
+		};
+
+		if (read_config.open_fetch_size_ > 0)
+		{
+			// a missing or forbidden object is reported by the GET, without a HEAD request
+			auto first_block_outcome = GetFirstBlock(bucketname, objectname, read_config.open_fetch_size_);
+			PASS_OUTCOME_ON_ERROR(first_block_outcome);
+			FirstBlock first_block{first_block_outcome.GetResultWithOwnership()};
+			auto layout = make_layout(first_block.object_size_, first_block.etag_);
+
+			auto reader = Aws::MakeUnique<Reader>(KHIOPS_S3, std::move(bucketname), std::move(objectname),
+							      std::move(layout));
+			reader->first_block_ = std::move(first_block.data_);
+			return SimpleOutcome<ReaderPtr>(std::move(reader));
+		}
 
-		Aws::Vector<Aws::String> objectnames(1, objectname);
-		Aws::Vector<tOffset> sizes(1, size);
+		const auto head_outcome = HeadObject(bucketname, objectname);
+		RETURN_OUTCOME_ON_ERROR(head_outcome);
+		const auto& head_result = head_outcome.GetResult();
+		auto layout = make_layout(head_result.GetContentLength(), head_result.GetETag());
 
-		return Aws::MakeUnique<Reader>(KHIOPS_S3, std::move(bucketname), std::move(objectname), 0, 0,
-					       std::move(objectnames), std::move(sizes));
+		return Aws::MakeUnique<Reader>(KHIOPS_S3, std::move(bucketname), std::move(objectname), std::move(layout));
 	}
 
 	// this is a multifile. the reader object needs the list of filenames matching the globbing pattern and their
-	// metadata, mainly their respective sizes.
-
-	// Note: getting the metadata involves a tradeoff between memory size of the data kept and the amount of data copied:
-	// storing only the relevant data in the MultiPartFile struct requires another copy of each object name, since the API
-	// does not allow moving from its own Object types. These copies could be avoided by keeping the entire list of Objects,
-	// at the cost of the space used by the other metadata. The implementation here will save that space.
+	// metadata, mainly their respective sizes. The handles opening the same files share these in the layout registry,
+	// so that only the first one builds the layout and checks the headers.
 
 	KH_S3_FILTER_LIST(file_list, bucketname, objectname,
 			  pattern_1st_sp_char_pos); // !! file_list and file_list_outcome now in scope
 
 	KH_S3_EMPTY_LIST(file_list);
 
+	auto layout = layout_registry.Lookup(layout_key, file_list);
+	if (layout)
+	{
+		return Aws::MakeUnique<Reader>(KHIOPS_S3, std::move(bucketname), std::move(objectname), std::move(layout));
+	}
+
 	const size_t file_count = file_list.size();
-	Aws::Vector<Aws::String> filenames(file_count);
-	Aws::Vector<long long> cumulative_size(file_count);
+	if (file_count > 1 && lazy)
+	{
+		// the headers are checked in the background, the first part does not depend on the result. Until then, the
+		// handle has its own layout with the sizes of the parts as listed.
+		auto reader = Aws::MakeUnique<Reader>(KHIOPS_S3, std::move(bucketname), std::move(objectname),
+						      std::make_shared<const FileLayout>(MakeMultifileLayout(file_list, 0)));
+		reader->total_size_ = reader->layout_->cumulative_sizes_.front();
+		const ObjectListPtr objects = file_list_outcome.GetResult();
+		const Aws::String& bucket = reader->bucketname_;
+		reader->pending_layout_ =
+		    std::async(std::launch::async,
+			       [bucket, objects, layout_key]() -> SimpleOutcome<FileLayoutPtr>
+			       {
+				       const auto header_length_outcome = GetCommonHeaderLength(bucket, *objects);
+				       PASS_OUTCOME_ON_ERROR(header_length_outcome);
+				       return layout_registry.Intern(
+					   layout_key, MakeMultifileLayout(*objects, header_length_outcome.GetResult()));
+			       })
+			.share();
+		return SimpleOutcome<ReaderPtr>(std::move(reader));
+	}
 
-	// get metadata from the first file
-	const auto& first_file = file_list.front();
-	filenames.front() = first_file.GetKey();
-	cumulative_size.front() = first_file.GetSize();
 	tOffset common_header_length = 0;
-
 	if (file_count > 1)
 	{
-		bool same_header = true;
-
 		// more than one file, the headers need to be checked
-		KH_S3_READ_HEADER(header, bucketname, first_file); // !! puts header and header_outcome into scope
-		tOffset header_length = static_cast<tOffset>(header.size());
-
-		for (size_t i = 1; i < file_count; i++)
-		{
-			const auto& curr_file = file_list[i];
-			filenames[i] = curr_file.GetKey();
-			cumulative_size[i] = cumulative_size[i - 1] + curr_file.GetSize();
-
-			if (same_header)
-			{
-				// continue checking the header of the file:
-				KH_S3_READ_HEADER(curr_header, bucketname,
-						  curr_file); // !! puts curr_header and curr_header_outcome into scope
-				same_header = (curr_header == header);
-			}
-		}
-
-		// if headers remained the same, adjust the cumulative sizes
-		if (same_header)
-		{
-			common_header_length = header_length;
-			for (size_t i = 1; i < file_count; i++)
-			{
-				cumulative_size[i] -= (i * common_header_length);
-			}
-		}
+		const auto header_length_outcome = GetCommonHeaderLength(bucketname, file_list);
+		PASS_OUTCOME_ON_ERROR(header_length_outcome);
+		common_header_length = header_length_outcome.GetResult();
 	}
 
 	// construct the result
-	return Aws::MakeUnique<Reader>(KHIOPS_S3, std::move(bucketname), std::move(objectname), 0,
-				       common_header_length, std::move(filenames), std::move(cumulative_size));
+	layout = layout_registry.Intern(layout_key, MakeMultifileLayout(file_list, common_header_length));
+	return Aws::MakeUnique<Reader>(KHIOPS_S3, std::move(bucketname), std::move(objectname), std::move(layout));
 }
 
 SimpleOutcome<WriterPtr> MakeWriterPtr(Aws::String bucket, Aws::String object)
 {
-	Aws::S3::Model::CreateMultipartUploadRequest request;
-	request.SetBucket(std::move(bucket));
-	request.SetKey(std::move(object));
-	auto outcome = client->CreateMultipartUpload(request);
-	RETURN_OUTCOME_ON_ERROR(outcome);
-	return Aws::MakeUnique<Writer>(KHIOPS_S3, outcome.GetResultWithOwnership());
+	return Aws::MakeUnique<Writer>(KHIOPS_S3, std::move(bucket), std::move(object));
 }
 
 // This template is only here to get specialized
@@ -1133,12 +3769,14 @@ template <typename T> T* PushBackHandle(Aws::UniquePtr<T>&&)
 
 template <> Reader* PushBackHandle<Reader>(ReaderPtr&& stream_ptr)
 {
+	std::lock_guard<std::mutex> lock(handles_mutex);
 	active_reader_handles.push_back(std::move(stream_ptr));
 	return active_reader_handles.back().get();
 }
 
 template <> Writer* PushBackHandle<Writer>(WriterPtr&& stream_ptr)
 {
+	std::lock_guard<std::mutex> lock(handles_mutex);
 	active_writer_handles.push_back(std::move(stream_ptr));
 	return active_writer_handles.back().get();
 }
@@ -1155,7 +3793,9 @@ RegisterStream(std::function<SimpleOutcome<Aws::UniquePtr<Stream>>(Aws::String,
 
 SimpleOutcome<Reader*> RegisterReader(Aws::String&& bucket, Aws::String&& object)
 {
-	return RegisterStream<Reader>(MakeReaderPtr, std::move(bucket), std::move(object));
+	return RegisterStream<Reader>([](Aws::String bucket_name, Aws::String object_name)
+				      { return MakeReaderPtr(std::move(bucket_name), std::move(object_name), read_config.lazy_open_); },
+				      std::move(bucket), std::move(object));
 }
 
 SimpleOutcome<Writer*> RegisterWriter(Aws::String&& bucket, Aws::String&& object)
@@ -1177,8 +3817,40 @@ template <typename Result> void UpdateUploadMetadata(Writer& writer, const Resul
 	writer.part_tracker_++;
 }
 
+UploadOutcome StartUpload(Writer& writer, Metadata metadata)
+{
+	if (IsUploadStarted(writer))
+	{
+		return true;
+	}
+
+	Aws::S3::Model::CreateMultipartUploadRequest request;
+	request.SetBucket(writer.bucketname_);
+	request.SetKey(writer.filename_);
+	request.SetMetadata(std::move(metadata));
+	auto outcome = client->CreateMultipartUpload(request);
+	RETURN_OUTCOME_ON_ERROR(outcome);
+	writer.writer_ = outcome.GetResultWithOwnership();
+	return true;
+}
+
+// Metadata of the header found at the start of the data, empty if the data does not contain a whole line
+Metadata MakeHeaderMetadata(const Aws::Vector<unsigned char>& data)
+{
+	const auto newline_it = std::find(data.begin(), data.end(), '\n');
+	if (newline_it == data.end())
+	{
+		return Metadata{};
+	}
+	return MakeHeaderMetadata(Aws::String(data.begin(), newline_it + 1));
+}
+
 UploadOutcome UploadPart(Writer& writer)
 {
+	// the first part holds the header of the file
+	const auto start_outcome = StartUpload(writer, MakeHeaderMetadata(writer.buffer_));
+	PASS_OUTCOME_ON_ERROR(start_outcome);
+
 	auto& buffer = writer.buffer_;
 	Aws::Utils::Stream::PreallocatedStreamBuf pre_buf(buffer.data(), buffer.size());
 	const auto request = MakeUploadPartRequest(writer, pre_buf);
@@ -1261,6 +3933,13 @@ void* driver_fopen(const char* filename, char mode)
 	}
 	case 'w':
 	{
+		// the upload is only created with the first part: a missing or forbidden bucket is reported here, before
+		// the host relies on the output
+		Aws::S3::Model::HeadBucketRequest bucket_request;
+		bucket_request.SetBucket(names.bucket_);
+		const auto bucket_outcome = client->HeadBucket(bucket_request);
+		RETURN_ON_ERROR(bucket_outcome, "Error while opening writer stream", nullptr);
+
 		KH_S3_REGISTER_STREAM(Writer, names.bucket_, names.object_, "Error while opening writer stream");
 	}
 	case 'a':
@@ -1274,11 +3953,11 @@ void* driver_fopen(const char* filename, char mode)
 			const auto file_list_outcome =
 			    FilterList(names.bucket_, names.object_, pattern_1st_sp_char_pos);
 			RETURN_ON_ERROR(file_list_outcome, "Error while looking for existing file", nullptr);
-			const ObjectsVec& file_list = file_list_outcome.GetResult();
+			const ObjectList& file_list = *file_list_outcome.GetResult();
 
 			if (!file_list.empty())
 			{
-				target = file_list.back().GetKey();
+				target = file_list.GetKey(file_list.size() - 1);
 			}
 			else
 			{
@@ -1295,8 +3974,7 @@ void* driver_fopen(const char* filename, char mode)
 		if (!head_outcome.IsSuccess())
 		{
 			auto& error = head_outcome.GetError();
-			if (error.GetErrorType() == Aws::S3::S3Errors::NO_SUCH_KEY ||
-			    error.GetErrorType() == Aws::S3::S3Errors::RESOURCE_NOT_FOUND)
+			if (IsNotFoundError(error))
 			{
 				// source file not found, fallback to simple write mode
 				spdlog::debug("No source file to append to, falling back to simple write.");
@@ -1320,6 +3998,11 @@ void* driver_fopen(const char* filename, char mode)
 		auto writer_ptr = register_outcome.GetResult();
 		writer_ptr->append_target_ = head_outcome.GetResult().GetVersionId();
 
+		// the header of the file is the one of the source
+		const auto start_outcome =
+		    StartUpload(*writer_ptr, GetHeaderMetadata(head_outcome.GetResult().GetMetadata()));
+		RETURN_ON_ERROR(start_outcome, "Error while initiating append stream", nullptr);
+
 		// requests for copy
 		const auto init_outcome =
 		    InitiateAppend(*writer_ptr, static_cast<size_t>(head_outcome.GetResult().GetContentLength()));
@@ -1334,10 +4017,8 @@ void* driver_fopen(const char* filename, char mode)
 }
 
 #define KH_S3_FIND_AND_REMOVE(type, container, stream)                                                                 \
-	auto type##_handle_it = FindHandle((container), (stream));                                                     \
-	if (type##_handle_it != (container).end())                                                                     \
+	if (RemoveHandle((container), (stream)))                                                                       \
 	{                                                                                                              \
-		EraseRemove((container), type##_handle_it);                                                            \
 		return kCloseSuccess;                                                                                  \
 	}
 
@@ -1349,20 +4030,22 @@ int driver_fclose(void* stream)
 
 	spdlog::debug("fclose {}", (void*)stream);
 
+	WaitPendingReads(stream);
 	KH_S3_FIND_AND_REMOVE(reader, active_reader_handles, stream);
 
-	auto writer_h_it = FindHandle(active_writer_handles, stream);
-	if (writer_h_it != active_writer_handles.end())
+	Writer* writer_ptr = LookupHandle(active_writer_handles, stream);
+	if (writer_ptr != nullptr)
 	{
 		// end multipart upload
 		// first, flush the pending data
-		auto& writer = **writer_h_it;
+		auto& writer = *writer_ptr;
 		const auto upload_outcome = UploadPart(writer);
 		RETURN_ON_ERROR(upload_outcome, "Error during upload", kCloseEOF);
 
 		// close upload
 		const auto complete_outcome =
 		    client->CompleteMultipartUpload(MakeCompleteMultipartUploadRequest(writer));
+		InvalidateMetadata(writer.bucketname_, writer.filename_);
 
 		// the request can fail and allow retries.
 		// if the request fails, the parts are still present on server side!
@@ -1370,7 +4053,7 @@ int driver_fclose(void* stream)
 		// the list of active handles.
 		RETURN_ON_ERROR(complete_outcome, "Error completing upload while closing stream", kCloseEOF);
 
-		EraseRemove(active_writer_handles, writer_h_it);
+		RemoveHandle(active_writer_handles, stream);
 
 		return kCloseSuccess;
 	}
@@ -1417,6 +4100,10 @@ int driver_fseek(void* stream, long long int offset, int whence)
 		computed_offset = h.offset_ + offset;
 		break;
 	case std::ios::end:
+	{
+		// the size of a lazily opened multifile is known once its headers are checked
+		const auto resolve_outcome = ResolveCommonHeader(h);
+		RETURN_ON_ERROR(resolve_outcome, "Error while checking the headers of the file", kBadSize);
 		if (h.total_size_ > 0)
 		{
 			long long minus1 = h.total_size_ - 1;
@@ -1434,6 +4121,7 @@ int driver_fseek(void* stream, long long int offset, int whence)
 
 		computed_offset = (h.total_size_ == 0) ? offset : h.total_size_ - 1 + offset;
 		break;
+	}
 	default:
 		LogError("Invalid seek mode " + std::to_string(whence));
 		return kBadSize;
@@ -1448,6 +4136,434 @@ int driver_fseek(void* stream, long long int offset, int whence)
 	return 0;
 }
 
+int driver_fadvise(void* stream, long long int offset, long long int length, int advice)
+{
+	KH_S3_NOT_CONNECTED(kBadSize);
+
+	ERROR_ON_NULL_ARG(stream, kBadSize);
+
+	FIND_HANDLE_OR_ERROR(active_reader_handles, stream, kBadSize);
+	auto& h = *h_ptr;
+
+	spdlog::debug("fadvise {} {} {} {}", stream, offset, length, advice);
+
+	if (offset < 0 || length < 0)
+	{
+		LogError("Invalid advice range " + std::to_string(offset) + ", " + std::to_string(length));
+		return kBadSize;
+	}
+
+	switch (advice)
+	{
+	case DRIVER_FADV_NORMAL:
+		h.access_hint_ = AccessHint::kNormal;
+		break;
+	case DRIVER_FADV_SEQUENTIAL:
+		h.access_hint_ = AccessHint::kSequential;
+		break;
+	case DRIVER_FADV_RANDOM:
+		h.access_hint_ = AccessHint::kRandom;
+		h.read_ahead_.Clear();
+		h.stream_.Close();
+		h.next_part_stream_.Close();
+		break;
+	case DRIVER_FADV_WILLNEED:
+	case DRIVER_FADV_DONTNEED:
+	{
+		// the range may go past the first part of a lazily opened multifile
+		if (length == 0 || offset + length > h.total_size_)
+		{
+			const auto resolve_outcome = ResolveCommonHeader(h);
+			RETURN_ON_ERROR(resolve_outcome, "Error while checking the headers of the file", kBadSize);
+		}
+		const tOffset end = length == 0 || length > h.total_size_ - offset ? h.total_size_ : offset + length;
+		if (advice == DRIVER_FADV_WILLNEED)
+		{
+			PrefetchRange(h, offset, end);
+		}
+		else
+		{
+			DiscardRange(h, offset, end);
+		}
+		break;
+	}
+	default:
+		LogError("Invalid advice " + std::to_string(advice));
+		return kBadSize;
+	}
+
+	return 0;
+}
+
+int driver_prefetch(void* stream, long long int offset, long long int length)
+{
+	return driver_fadvise(stream, offset, length, DRIVER_FADV_WILLNEED);
+}
+
+// Consecutive bytes of the file covering one or more ranges of a scatter-gather read
+struct ReadvRun
+{
+	tOffset start_{0};
+	tOffset end_{0};
+	Aws::Vector<size_t> ranges_;
+	Aws::Vector<BufferSegment> segments_; // where the bytes of the run go, in file order
+	Aws::Vector<unsigned char> gaps_;     // bytes between the ranges, read and dropped
+	tOffset valid_end_{0};		      // the data stops here if the end of the file was met
+};
+
+long long int driver_freadv(void* stream, const driver_read_range* ranges, size_t count)
+{
+	KH_S3_NOT_CONNECTED(kBadSize);
+
+	ERROR_ON_NULL_ARG(stream, kBadSize);
+	if (count > 0)
+	{
+		ERROR_ON_NULL_ARG(ranges, kBadSize);
+	}
+
+	spdlog::debug("freadv {} {}", stream, count);
+
+	FIND_HANDLE_OR_ERROR(active_reader_handles, stream, kBadSize);
+	auto& h = *h_ptr;
+
+	tOffset max_end{0};
+	for (size_t i = 0; i < count; i++)
+	{
+		const auto& range = ranges[i];
+		if (range.offset < 0 || range.length < 0 || range.offset > std::numeric_limits<long long>::max() - range.length ||
+		    (range.length > 0 && range.buffer == nullptr))
+		{
+			LogError("Invalid read range " + std::to_string(i));
+			return kBadSize;
+		}
+		max_end = std::max(max_end, range.offset + range.length);
+	}
+
+	// reads past the first part of a lazily opened multifile need the result of the header check
+	if (max_end > h.layout_->cumulative_sizes_.front())
+	{
+		const auto resolve_outcome = ResolveCommonHeader(h);
+		RETURN_ON_ERROR(resolve_outcome, "Error while checking the headers of the file", kBadSize);
+	}
+	const tOffset total_size = h.total_size_;
+
+	// ranges in file order, those close to each other are merged in runs
+	Aws::Vector<size_t> order;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (ranges[i].length > 0 && ranges[i].offset < total_size)
+		{
+			order.push_back(i);
+		}
+	}
+	std::sort(order.begin(), order.end(),
+		  [ranges](size_t a, size_t b) { return ranges[a].offset < ranges[b].offset; });
+
+	Aws::Vector<ReadvRun> runs;
+	for (const size_t i : order)
+	{
+		const tOffset start = ranges[i].offset;
+		const tOffset end = std::min(total_size, start + ranges[i].length);
+		if (runs.empty() || start > runs.back().end_ + read_config.readv_merge_gap_ ||
+		    std::max(runs.back().end_, end) - runs.back().start_ > read_config.readv_max_run_)
+		{
+			runs.emplace_back();
+			runs.back().start_ = start;
+		}
+		ReadvRun& run = runs.back();
+		run.end_ = std::max(run.end_, end);
+		run.ranges_.push_back(i);
+	}
+
+	// the runs are read concurrently, the long ones in stripes
+	const tOffset piece_size =
+	    read_config.stripe_size_ > 0 ? read_config.stripe_size_ : std::numeric_limits<tOffset>::max();
+	Aws::Vector<std::future<SizeOutcome>> pieces;
+	Aws::Vector<std::pair<size_t, tOffset>> piece_runs; // run index and piece start
+	for (size_t r = 0; r < runs.size(); r++)
+	{
+		// the ranges are read in place, the bytes asked twice only in the buffer of the first range asking them
+		ReadvRun& run = runs[r];
+		tOffset gaps_size{0};
+		tOffset covered_end = run.start_;
+		for (const size_t i : run.ranges_)
+		{
+			gaps_size += std::max(tOffset{0}, ranges[i].offset - covered_end);
+			covered_end = std::max(covered_end, std::min(total_size, ranges[i].offset + ranges[i].length));
+		}
+		run.gaps_.resize(static_cast<size_t>(gaps_size));
+
+		unsigned char* gap = run.gaps_.data();
+		covered_end = run.start_;
+		for (const size_t i : run.ranges_)
+		{
+			const tOffset start = ranges[i].offset;
+			const tOffset end = std::min(total_size, start + ranges[i].length);
+			if (start > covered_end)
+			{
+				run.segments_.push_back(BufferSegment{gap, static_cast<size_t>(start - covered_end)});
+				gap += start - covered_end;
+				covered_end = start;
+			}
+			if (end > covered_end)
+			{
+				unsigned char* buffer = static_cast<unsigned char*>(ranges[i].buffer) + (covered_end - start);
+				run.segments_.push_back(BufferSegment{buffer, static_cast<size_t>(end - covered_end)});
+				covered_end = end;
+			}
+		}
+		run.valid_end_ = run.end_;
+
+		const MultiPartFile* source = &h;
+		for (tOffset piece_start = run.start_; piece_start < run.end_;)
+		{
+			const tOffset piece_length = std::min(piece_size, run.end_ - piece_start);
+			const Aws::Vector<BufferSegment> piece_segments =
+			    SliceSegments(run.segments_, piece_start - run.start_, piece_length);
+			pieces.push_back(SubmitTask(
+			    [source, piece_start, piece_segments, piece_length]()
+			    { return ReadMultifileRangeToSegments(*source, piece_start, piece_segments, piece_length); }));
+			piece_runs.emplace_back(r, piece_start);
+			piece_start += piece_length;
+		}
+	}
+
+	spdlog::debug("freadv of {} ranges in {} runs, {} requests", count, runs.size(), pieces.size());
+
+	// every piece is waited for, even after an error, since they write to the caller's buffers
+	bool failed = false;
+	for (size_t p = 0; p < pieces.size(); p++)
+	{
+		const SizeOutcome piece_outcome = pieces[p].get();
+		if (!piece_outcome.IsSuccess())
+		{
+			if (!failed)
+			{
+				LogBadOutcome(piece_outcome, "Error while reading file");
+				failed = true;
+			}
+			continue;
+		}
+
+		// a short piece means the end of the file was met
+		ReadvRun& run = runs[piece_runs[p].first];
+		const tOffset piece_start = piece_runs[p].second;
+		const tOffset piece_end = std::min(run.end_, piece_start + piece_size);
+		if (piece_start + piece_outcome.GetResult() < piece_end)
+		{
+			run.valid_end_ = std::min(run.valid_end_, piece_start + piece_outcome.GetResult());
+		}
+	}
+	if (failed)
+	{
+		return kBadSize;
+	}
+
+	long long int total_read{0};
+	for (const auto& run : runs)
+	{
+		tOffset covered_end = run.start_;
+		for (const size_t i : run.ranges_)
+		{
+			const tOffset start = ranges[i].offset;
+			const tOffset range_read =
+			    std::max(tOffset{0}, std::min(start + ranges[i].length, run.valid_end_) - start);
+
+			// the bytes also asked by a previous range were read into its buffer
+			unsigned char* buffer = static_cast<unsigned char*>(ranges[i].buffer);
+			const tOffset shared_end = std::min(covered_end, start + range_read);
+			for (const auto& segment : SliceSegments(run.segments_, start - run.start_, shared_end - start))
+			{
+				buffer = std::copy_n(segment.data_, segment.size_, buffer);
+			}
+			covered_end = std::max(covered_end, start + ranges[i].length);
+			total_read += range_read;
+		}
+	}
+	return total_read;
+}
+
+long long int driver_freadAsync(void* stream, void* ptr, size_t size, size_t count)
+{
+	KH_S3_NOT_CONNECTED(kBadSize);
+
+	ERROR_ON_NULL_ARG(stream, kBadSize);
+	ERROR_ON_NULL_ARG(ptr, kBadSize);
+
+	if (0 == size)
+	{
+		LogError("Error passing size of 0");
+		return kBadSize;
+	}
+
+	spdlog::debug("freadAsync {} {} {} {}", stream, ptr, size, count);
+
+	FIND_HANDLE_OR_ERROR(active_reader_handles, stream, kBadSize);
+	auto& h = *h_ptr;
+
+	// the stripes run on the executor, nothing waits for them until the caller does
+	PendingRead pending;
+	pending.stream_ = stream;
+
+	// fast exit for 0 read, the token reads nothing and the position stays where it is, even past the end
+	const tOffset offset = h.offset_;
+	if (0 == count)
+	{
+		std::lock_guard<std::mutex> lock(pending_reads_mutex);
+		const long long token = next_read_token++;
+		pending_reads.emplace(token, std::move(pending));
+		return token;
+	}
+
+	if (WillSizeCountProductOverflow(size, count))
+	{
+		LogError("product size * count is too large, would overflow");
+		return kBadSize;
+	}
+	tOffset to_read{static_cast<tOffset>(size * count)};
+	if (offset > std::numeric_limits<long long>::max() - to_read)
+	{
+		LogError("signed overflow prevented on reading attempt");
+		return kBadSize;
+	}
+
+	// reads past the first part of a lazily opened multifile need the result of the header check
+	if (offset + to_read > h.layout_->cumulative_sizes_.front())
+	{
+		const auto resolve_outcome = ResolveCommonHeader(h);
+		RETURN_ON_ERROR(resolve_outcome, "Error while checking the headers of the file", kBadSize);
+	}
+	if (offset >= h.total_size_)
+	{
+		LogError("Error trying to read more bytes while already out of bounds");
+		return kBadSize;
+	}
+	to_read = std::max<tOffset>(0, std::min(to_read, h.total_size_ - offset));
+
+	const tOffset stripe_size = read_config.stripe_size_ > 0 ? read_config.stripe_size_ : to_read;
+	const MultiPartFile* source = &h;
+	unsigned char* buffer = static_cast<unsigned char*>(ptr);
+	for (tOffset stripe_start = 0; stripe_start < to_read; stripe_start += stripe_size)
+	{
+		const tOffset stripe_offset = offset + stripe_start;
+		const tOffset stripe_length = std::min(stripe_size, to_read - stripe_start);
+		unsigned char* stripe_buffer = buffer + stripe_start;
+		pending.pieces_.push_back(SubmitTask([source, stripe_offset, stripe_buffer, stripe_length]()
+						     { return ReadMultifileRange(*source, stripe_offset, stripe_buffer, stripe_length); }));
+		pending.piece_lengths_.push_back(stripe_length);
+	}
+	h.offset_ += to_read;
+
+	std::lock_guard<std::mutex> lock(pending_reads_mutex);
+	const long long token = next_read_token++;
+	pending_reads.emplace(token, std::move(pending));
+	return token;
+}
+
+long long int driver_wait(long long int token)
+{
+	KH_S3_NOT_CONNECTED(kBadSize);
+
+	spdlog::debug("wait {}", token);
+
+	PendingRead pending;
+	{
+		std::lock_guard<std::mutex> lock(pending_reads_mutex);
+		const auto pending_it = pending_reads.find(token);
+		if (pending_it == pending_reads.end())
+		{
+			LogError("Unknown read token " + std::to_string(token));
+			return kBadSize;
+		}
+		pending = std::move(pending_it->second);
+		pending_reads.erase(pending_it);
+	}
+
+	// every stripe is waited for, even after an error, since they all write to the caller's buffer
+	tOffset bytes_read{0};
+	bool contiguous = true;
+	bool failed = false;
+	for (size_t i = 0; i < pending.pieces_.size(); i++)
+	{
+		const SizeOutcome piece_outcome = pending.pieces_[i].get();
+		if (!piece_outcome.IsSuccess())
+		{
+			if (!failed)
+			{
+				LogBadOutcome(piece_outcome, "Error while reading from file");
+				failed = true;
+			}
+			continue;
+		}
+
+		// a short stripe means the end of the file was met, the data after it is not valid
+		if (contiguous)
+		{
+			bytes_read += piece_outcome.GetResult();
+			contiguous = piece_outcome.GetResult() == pending.piece_lengths_[i];
+		}
+	}
+	return failed ? kBadSize : bytes_read;
+}
+
+int driver_poll(long long int token)
+{
+	KH_S3_NOT_CONNECTED(kBadSize);
+
+	std::lock_guard<std::mutex> lock(pending_reads_mutex);
+	const auto pending_it = pending_reads.find(token);
+	if (pending_it == pending_reads.end())
+	{
+		LogError("Unknown read token " + std::to_string(token));
+		return kBadSize;
+	}
+	const auto& pieces = pending_it->second.pieces_;
+	const bool done = std::all_of(pieces.begin(), pieces.end(),
+				      [](const std::future<SizeOutcome>& piece)
+				      { return piece.wait_for(std::chrono::seconds(0)) == std::future_status::ready; });
+	return done ? 1 : 0;
+}
+
+long long int driver_pread(void* stream, void* ptr, size_t len, long long int offset)
+{
+	KH_S3_NOT_CONNECTED(kBadSize);
+
+	ERROR_ON_NULL_ARG(stream, kBadSize);
+	ERROR_ON_NULL_ARG(ptr, kBadSize);
+
+	spdlog::debug("pread {} {} {} {}", stream, ptr, len, offset);
+
+	FIND_HANDLE_OR_ERROR(active_reader_handles, stream, kBadSize);
+	const auto& h = *h_ptr;
+
+	if (offset < 0)
+	{
+		LogError("Invalid read offset " + std::to_string(offset));
+		return kBadSize;
+	}
+	if (len > static_cast<size_t>(std::numeric_limits<long long>::max() - offset))
+	{
+		LogError("signed overflow prevented on reading attempt");
+		return kBadSize;
+	}
+
+	// the layout of a lazily opened multifile is settled before reading, whatever the range
+	const auto resolve_outcome = ResolveCommonHeader(*h_ptr);
+	RETURN_ON_ERROR(resolve_outcome, "Error while checking the headers of the file", kBadSize);
+
+	if (offset >= h.total_size_ || len == 0)
+	{
+		return 0;
+	}
+	const tOffset to_read = std::min(static_cast<tOffset>(len), h.total_size_ - offset);
+
+	// only the immutable description of the file is used, not the cursor nor the buffers of sequential reads
+	const auto read_outcome = ReadMultifileRangeStriped(h, offset, static_cast<unsigned char*>(ptr), to_read);
+	RETURN_ON_ERROR(read_outcome, "Error while reading from file", kBadSize);
+
+	return read_outcome.GetResult();
+}
+
 const char* driver_getlasterror()
 {
 	spdlog::debug("getlasterror");
@@ -1497,6 +4613,13 @@ long long int driver_fread(void* ptr, size_t size, size_t count, void* stream)
 	}
 	// end of overflow prevention
 
+	// reads past the first part of a lazily opened multifile need the result of the header check
+	if (offset + to_read > h.layout_->cumulative_sizes_.front())
+	{
+		const auto resolve_outcome = ResolveCommonHeader(h);
+		RETURN_ON_ERROR(resolve_outcome, "Error while checking the headers of the file", kBadSize);
+	}
+
 	// special case: if offset >= total_size, error if not 0 byte required. 0 byte required is already done above
 	const tOffset total_size = h.total_size_;
 	if (offset >= total_size)
@@ -1630,6 +4753,7 @@ int driver_remove(const char* filename)
 	request.WithBucket(names.bucket_).WithKey(names.object_);
 
 	Aws::S3::Model::DeleteObjectOutcome outcome = client->DeleteObject(request);
+	InvalidateMetadata(names.bucket_, names.object_);
 
 	if (!outcome.IsSuccess())
 	{
@@ -1691,38 +4815,40 @@ int driver_copyToLocal(const char* sSourceFilePathName, const char* sDestFilePat
 		return kFailure;
 	}
 
+	// the content goes through the same caches as the reads
 	auto read_and_write = [](const Reader& from, size_t part, std::ofstream& to_file) -> bool
 	{
 		// file metadata
-		const long long header_size = from.common_header_length_;
+		const long long header_size = from.layout_->common_header_length_;
 
 		// limit download to a few MBs at a time.
 		constexpr long long dl_limit{10 * 1024 * 1024};
 
-		const long long file_size = part == 0 ? 
-			from.cumulative_sizes_[0] : header_size + from.cumulative_sizes_[part]-from.cumulative_sizes_[part-1];
+		const long long file_size = GetPartSize(from, part);
+		Aws::Vector<unsigned char> buffer(static_cast<size_t>(std::min(dl_limit, file_size)));
 
-		// download range limits
-		const long long end_limit = file_size - 1;
+		//download by pieces, after the bytes fetched on open if any
 		long long start = 0 == part ? 0 : header_size;
-		long long end = std::min(start + dl_limit - 1, end_limit);
-
-		//download by pieces
-		while (to_file && start < end_limit)
+		if (0 == part && !from.first_block_.empty())
 		{
-			const auto request =
-			    MakeGetObjectRequest(from.bucketname_, from.filenames_[part], MakeByteRange(start, end));
-			auto get_outcome = client->GetObject(request);
-			RETURN_ON_ERROR(get_outcome, "Error while downloading file content", false);
-
-			// get ownership of the result and its underlying stream
-			const Aws::S3::Model::GetObjectResult result{get_outcome.GetResultWithOwnership()};
-			to_file << result.GetBody().rdbuf();
+			to_file.write(reinterpret_cast<const char*>(from.first_block_.data()),
+				      static_cast<std::streamsize>(from.first_block_.size()));
+			start = static_cast<long long>(from.first_block_.size());
+		}
+		while (to_file && start < file_size)
+		{
+			const long long end = std::min(start + dl_limit, file_size) - 1;
+			const auto read_outcome = ReadPartRange(from, part, buffer.data(), start, end);
+			RETURN_ON_ERROR(read_outcome, "Error while downloading file content", false);
 
-			start +=
-			    result
-				.GetContentLength(); // a bit of security for now: could the downloading be incomplete?
-			end = std::min(start + dl_limit - 1, end_limit);
+			const long long read = read_outcome.GetResult();
+			if (0 == read)
+			{
+				// the object is shorter than when it was listed
+				break;
+			}
+			to_file.write(reinterpret_cast<const char*>(buffer.data()), static_cast<std::streamsize>(read));
+			start += read;
 		}
 		// what made the process stop?
 		if (!to_file)
@@ -1736,7 +4862,7 @@ int driver_copyToLocal(const char* sSourceFilePathName, const char* sDestFilePat
 	};
 
 	const Reader& reader = *(make_reader_outcome.GetResult());
-	const size_t parts_count{reader.filenames_.size()};
+	const size_t parts_count{reader.layout_->parts_.size()};
 
 	bool op_res = true;
 	for (size_t part = 0; part < parts_count && op_res; part++)
@@ -1790,6 +4916,7 @@ int driver_copyFromLocal(const char* sSourceFilePathName, const char* sDestFileP
 
 	// Exécution de la requête
 	auto put_object_outcome = client->PutObject(object_request);
+	InvalidateMetadata(names.bucket_, names.object_);
 
 	if (!put_object_outcome.IsSuccess())
 	{
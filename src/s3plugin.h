@@ -144,6 +144,65 @@ VISIBLE int driver_copyToLocal(const char *sourcefilename,
 VISIBLE int driver_copyFromLocal(const char *sourcefilename,
                                  const char *destfilename);
 
+// Access advice for driver_fadvise, with the meaning of their posix_fadvise
+// counterparts
+#define DRIVER_FADV_NORMAL 0     // default heuristics
+#define DRIVER_FADV_RANDOM 1     // no read-ahead
+#define DRIVER_FADV_SEQUENTIAL 2 // read-ahead from the first read
+#define DRIVER_FADV_WILLNEED 3   // fetch the range in the background
+#define DRIVER_FADV_DONTNEED 4   // release what is held for the range
+
+// Declare how a stream open for reading will be accessed. The range starts at
+// offset and spans length bytes, up to the end of the file if length is 0. It
+// only matters for DRIVER_FADV_WILLNEED and DRIVER_FADV_DONTNEED. Reads
+// return the same data whether or not the advice is given.
+// Returns 0 on success, -1 on error
+VISIBLE int driver_fadvise(void *stream, long long int offset,
+                           long long int length, int advice);
+
+// Same as driver_fadvise with DRIVER_FADV_WILLNEED
+// Returns 0 on success, -1 on error
+VISIBLE int driver_prefetch(void *stream, long long int offset,
+                            long long int length);
+
+// One range of a scatter-gather read: length bytes starting at offset, copied
+// to buffer
+typedef struct {
+  long long int offset;
+  long long int length;
+  void *buffer;
+} driver_read_range;
+
+// Read several ranges of a stream open for reading, the ranges being
+// downloaded concurrently. Ranges going past the end of the file are read up
+// to the end. The position of the stream is left unchanged.
+// Returns the total number of bytes read on success, -1 on error
+VISIBLE long long int driver_freadv(void *stream,
+                                    const driver_read_range *ranges,
+                                    size_t count);
+
+// Start reading size*count bytes at the current position of a stream open for
+// reading. The position moves past these bytes right away, so that the next
+// read can start before this one completes. ptr must stay valid until the read
+// is waited for.
+// Returns a token identifying the read, -1 on error
+VISIBLE long long int driver_freadAsync(void *stream, void *ptr, size_t size,
+                                        size_t count);
+
+// Wait for the end of a read started by driver_freadAsync, then release its
+// token
+// Returns the same as driver_fread
+VISIBLE long long int driver_wait(long long int token);
+
+// Returns 1 if the read is complete, 0 if it is still running, -1 on error
+VISIBLE int driver_poll(long long int token);
+
+// Read len bytes at offset from a stream open for reading, without using or
+// moving its position. Several threads may call it on the same stream.
+// Returns the number of bytes read, 0 past the end of the file, -1 on error
+VISIBLE long long int driver_pread(void *stream, void *ptr, size_t len,
+                                   long long int offset);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif /* __cplusplus */
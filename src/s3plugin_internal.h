@@ -1,10 +1,19 @@
 #pragma once
 
+#include <aws/core/utils/memory/stl/AWSDeque.h>
+#include <aws/core/utils/memory/stl/AWSList.h>
 #include <aws/s3/S3Client.h>
 #include <aws/s3/model/CompletedPart.h>
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <future>
 #include <memory>
+#include <mutex>
+#include <streambuf>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace s3plugin
@@ -22,27 +31,664 @@ constexpr long long kBadSize{-1};
 
 using tOffset = long long;
 
+struct SimpleError
+{
+	int code_;
+	Aws::String err_msg_;
+
+	Aws::String GetMessage() const
+	{
+		return std::to_string(code_) + err_msg_;
+	}
+};
+
+template <typename R> using SimpleOutcome = Aws::Utils::Outcome<R, SimpleError>;
+
+using SizeOutcome = SimpleOutcome<long long>;
+
+// Read settings, from the environment at connection time
+struct ReadConfig
+{
+	tOffset block_size_{8 * 1024 * 1024};
+	size_t window_blocks_{4};	     // 0 disables read-ahead
+	int sequential_reads_to_trigger_{2}; // consecutive reads needed to consider the access sequential
+	tOffset stripe_size_{4 * 1024 * 1024}; // larger reads are split in concurrent requests, 0 disables
+	size_t cache_size_{256 * 1024 * 1024};	 // memory budget of the block cache, 0 disables
+	tOffset cache_block_size_{1024 * 1024};
+	Aws::String cache_dir_; // directory of the persistent block cache, empty disables
+	size_t cache_dir_size_{1024 * 1024 * 1024}; // bytes of the persistent block cache
+	bool lazy_open_{false}; // multifile headers are checked in the background after opening
+	long long metadata_ttl_ms_{1000}; // lifetime of the cached object metadata and listings, 0 disables
+	size_t streaming_reads_{0}; // sequential scans open at most this number of streaming GETs, 0 disables
+	tOffset part_prefetch_distance_{8 * 1024 * 1024}; // the next part is streamed this close to its start
+	tOffset small_part_size_{1024 * 1024}; // below this average part size, parts are read ahead whole, 0 disables
+	tOffset open_fetch_size_{256 * 1024}; // first bytes of a single file fetched on open instead of a HEAD, 0 disables
+	size_t hedge_percentile_{0};  // a GET slower to answer than this percentile is duplicated, 0 disables
+	long long hedge_min_delay_ms_{20}; // never duplicated sooner
+	tOffset prefetch_budget_{64 * 1024 * 1024}; // memory per reader for the ranges announced with driver_fadvise
+	tOffset readv_merge_gap_{64 * 1024}; // ranges of a driver_freadv call closer than this are read by one request
+	tOffset readv_max_run_{8 * 1024 * 1024}; // ranges are not merged past this length
+	tOffset random_min_fetch_{64 * 1024};	    // small random reads fetch at least this much, 0 disables
+	tOffset random_max_fetch_{4 * 1024 * 1024}; // upper bound of the adaptive fetch size of random reads
+};
+
+// Identifies a block of a given version of an object
+struct BlockCacheKey
+{
+	Aws::String bucket_;
+	Aws::String object_;
+	Aws::String etag_;
+	tOffset index_;
+
+	bool operator==(const BlockCacheKey& other) const
+	{
+		return index_ == other.index_ && object_ == other.object_ && etag_ == other.etag_ &&
+		       bucket_ == other.bucket_;
+	}
+};
+
+struct BlockCacheKeyHash
+{
+	size_t operator()(const BlockCacheKey& key) const;
+};
+
+using BlockData = std::shared_ptr<const Aws::Vector<unsigned char>>;
+
+// Blocks of objects shared by all the readers, within a memory budget.
+// The blocks enter a probation segment and are promoted to a protected segment when they are hit,
+// so that a single scan through a large file does not evict the blocks read on every pass.
+class BlockCache
+{
+public:
+	explicit BlockCache(size_t budget) : budget_{budget} {}
+
+	void SetBudget(size_t budget);
+	size_t GetBudget() const;
+
+	// returns nullptr if the block is not in the cache
+	BlockData Lookup(const BlockCacheKey& key);
+	bool Contains(const BlockCacheKey& key) const;
+	void Insert(const BlockCacheKey& key, BlockData data);
+	void Clear();
+
+private:
+	struct Entry
+	{
+		BlockCacheKey key_;
+		BlockData data_;
+		bool protected_;
+	};
+	using EntryList = Aws::List<Entry>;
+
+	void EvictOverBudget();
+
+	mutable std::mutex mutex_;
+	EntryList probation_; // most recently used first
+	EntryList protected_; // most recently used first
+	std::unordered_map<BlockCacheKey, EntryList::iterator, BlockCacheKeyHash> index_;
+	size_t budget_{0};
+	size_t probation_size_{0};
+	size_t protected_size_{0};
+};
+
+// Block file of the cache directory, with its size and modification time
+struct DiskCacheFile
+{
+	Aws::String path_;
+	size_t size_;
+	long long mtime_;
+};
+
+// Size of the disk block cache directory, shared by all the processes using it. The usage is measured by listing the
+// directory and then follows the blocks the process writes. Once it goes past the budget by more than an eighth, the
+// directory is listed again and its least recently used files are removed, whichever process wrote them. Storing a
+// block of a new version of an object removes the blocks of its previous versions known to the process.
+class DiskCacheIndex
+{
+public:
+	void Reset(size_t budget);
+	size_t GetUsage() const;
+
+	// Record a block file written or read, returns the files to remove from the disk. over_budget is set if the
+	// directory needs to be listed again.
+	Aws::Vector<Aws::String> Insert(const Aws::String& path, const Aws::String& object_key, const Aws::String& etag,
+					size_t size, bool written, bool& over_budget);
+
+	// Measure the usage from the files of the directory, returns those to remove to fit in the budget: the
+	// oldest first, then the least recently used by the process, those it does not know first
+	Aws::Vector<Aws::String> Evict(Aws::Vector<DiskCacheFile> files);
+
+private:
+	struct Entry
+	{
+		Aws::String object_key_;
+		Aws::String etag_;
+		size_t size_;
+		unsigned long long last_use_;
+	};
+
+	mutable std::mutex mutex_;
+	std::unordered_map<Aws::String, Entry> entries_; // by path
+	std::unordered_map<Aws::String, Aws::String> versions_; // ETag of the latest block stored, by object
+	unsigned long long use_count_{0};
+	size_t budget_{0};
+	size_t usage_{0};
+};
+
+// Cache of request results that expire after a fixed delay. The driver's own writes and removals invalidate the
+// entries they affect.
+template <typename Value> class TtlCache
+{
+public:
+	void SetTtl(std::chrono::milliseconds ttl)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		ttl_ = ttl;
+		entries_.clear();
+	}
+
+	bool Lookup(const Aws::String& key, Value& value)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		const auto it = entries_.find(key);
+		if (it == entries_.end())
+		{
+			return false;
+		}
+		if (it->second.expiry_ <= std::chrono::steady_clock::now())
+		{
+			entries_.erase(it);
+			return false;
+		}
+		value = it->second.value_;
+		return true;
+	}
+
+	void Insert(const Aws::String& key, Value value)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (ttl_.count() <= 0)
+		{
+			return;
+		}
+		const auto now = std::chrono::steady_clock::now();
+		if (entries_.size() >= max_entries_)
+		{
+			EraseExpired(now);
+		}
+		if (entries_.size() >= max_entries_)
+		{
+			entries_.clear();
+		}
+		entries_[key] = Entry{now + ttl_, std::move(value)};
+	}
+
+	void Erase(const Aws::String& key)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		entries_.erase(key);
+	}
+
+	void Clear()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		entries_.clear();
+	}
+
+private:
+	struct Entry
+	{
+		std::chrono::steady_clock::time_point expiry_;
+		Value value_;
+	};
+
+	void EraseExpired(std::chrono::steady_clock::time_point now)
+	{
+		for (auto it = entries_.begin(); it != entries_.end();)
+		{
+			it = it->second.expiry_ <= now ? entries_.erase(it) : std::next(it);
+		}
+	}
+
+	static constexpr size_t max_entries_{4096};
+
+	std::mutex mutex_;
+	std::chrono::milliseconds ttl_{0};
+	std::unordered_map<Aws::String, Entry> entries_;
+};
+
+// Identical requests made while one is in flight wait for its result instead of being sent again
+template <typename Value> class SingleFlight
+{
+public:
+	template <typename Fetch> Value Do(const Aws::String& key, Fetch fetch)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		const auto it = in_flight_.find(key);
+		if (it != in_flight_.end())
+		{
+			std::shared_future<Value> result = it->second;
+			lock.unlock();
+			return result.get();
+		}
+		std::promise<Value> promise;
+		in_flight_.emplace(key, promise.get_future().share());
+		lock.unlock();
+
+		try
+		{
+			Value value = fetch();
+			Done(key);
+			promise.set_value(value);
+			return value;
+		}
+		catch (...)
+		{
+			Done(key);
+			promise.set_exception(std::current_exception());
+			throw;
+		}
+	}
+
+private:
+	void Done(const Aws::String& key)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		in_flight_.erase(key);
+	}
+
+	std::mutex mutex_;
+	std::unordered_map<Aws::String, std::shared_future<Value>> in_flight_;
+};
+
+// Times to first byte of the recent GET requests, from which the hedging deadline is derived
+class LatencyTracker
+{
+public:
+	void Record(std::chrono::microseconds latency)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (samples_.size() < max_samples_)
+		{
+			samples_.push_back(latency);
+		}
+		else
+		{
+			samples_[next_] = latency;
+		}
+		next_ = (next_ + 1) % max_samples_;
+	}
+
+	// false until enough samples were recorded
+	bool GetPercentile(size_t percentile, std::chrono::microseconds& latency)
+	{
+		Aws::Vector<std::chrono::microseconds> sorted;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (samples_.size() < min_samples_)
+			{
+				return false;
+			}
+			sorted = samples_;
+		}
+		const size_t rank = std::min(sorted.size() - 1, sorted.size() * percentile / 100);
+		std::nth_element(sorted.begin(), sorted.begin() + static_cast<std::ptrdiff_t>(rank), sorted.end());
+		latency = sorted[rank];
+		return true;
+	}
+
+	void Clear()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		samples_.clear();
+		next_ = 0;
+	}
+
+private:
+	static constexpr size_t min_samples_{16};
+	static constexpr size_t max_samples_{256};
+
+	std::mutex mutex_;
+	Aws::Vector<std::chrono::microseconds> samples_;
+	size_t next_{0};
+};
+
+// The first bytes of a single file, fetched on open in place of a HEAD request
+struct FirstBlock
+{
+	Aws::Vector<unsigned char> data_;
+	tOffset object_size_{0};
+	Aws::String etag_;
+};
+
+// Consecutive cache blocks downloaded by a single request, the last ones may be incomplete
+struct DownloadedRun
+{
+	Aws::Vector<std::shared_ptr<Aws::Vector<unsigned char>>> blocks_;
+	tOffset read_{0};
+};
+
+// Block of a multifile, downloaded in the background ahead of the reads
+struct ReadAheadBlock
+{
+	tOffset start_{0};
+	Aws::Vector<unsigned char> data_;
+	std::shared_future<SizeOutcome> download_;
+};
+
+using ReadAheadBlockPtr = Aws::UniquePtr<ReadAheadBlock>;
+
+// Sequential access detection and window of the blocks in flight for a reader.
+// The downloads reference the reader and the block buffers, so they are always waited for before
+// the blocks are discarded.
+struct ReadAheadWindow
+{
+	tOffset expected_offset_{0}; // where the next read starts if the access is sequential
+	int sequential_reads_{0};
+	Aws::Deque<ReadAheadBlockPtr> blocks_;
+
+	ReadAheadWindow() = default;
+	~ReadAheadWindow()
+	{
+		Clear();
+	}
+	ReadAheadWindow(const ReadAheadWindow&) = delete;
+	ReadAheadWindow& operator=(const ReadAheadWindow&) = delete;
+
+	// the blocks in flight are downloaded, they stay in the window
+	void Wait()
+	{
+		for (const auto& block : blocks_)
+		{
+			block->download_.wait();
+		}
+	}
+
+	void Clear()
+	{
+		Wait();
+		blocks_.clear();
+	}
+};
+
+// Ranges announced with driver_fadvise, downloaded in the background. As for the read-ahead, the downloads are
+// waited for before the blocks are discarded.
+struct PrefetchedRanges
+{
+	Aws::Deque<ReadAheadBlockPtr> blocks_; // oldest first
+	tOffset size_{0};
+
+	PrefetchedRanges() = default;
+	~PrefetchedRanges()
+	{
+		Clear();
+	}
+	PrefetchedRanges(const PrefetchedRanges&) = delete;
+	PrefetchedRanges& operator=(const PrefetchedRanges&) = delete;
+
+	void Wait()
+	{
+		for (const auto& block : blocks_)
+		{
+			block->download_.wait();
+		}
+	}
+
+	void Clear()
+	{
+		Wait();
+		blocks_.clear();
+		size_ = 0;
+	}
+};
+
+// Access pattern declared with driver_fadvise, overrides the detection of sequential reads
+enum class AccessHint
+{
+	kNormal,
+	kSequential,
+	kRandom
+};
+
+// Data fetched at the last random read. The fetch size grows while the random reads stay close to each other
+// and shrinks when they are scattered.
+struct RandomAccessWindow
+{
+	tOffset start_{0};
+	Aws::Vector<unsigned char> data_;
+	tOffset fetch_size_{0}; // 0 until the first random read
+};
+
+// Bounded buffer between a download writing the body of a response and a reader consuming it
+class StreamPipe : public std::streambuf
+{
+public:
+	explicit StreamPipe(size_t capacity) : data_(capacity) {}
+
+	// consumer side: waits for some data, returns 0 once the download is over
+	size_t Read(unsigned char* dest, size_t count);
+	// the consumer leaves, pending and future writes fail
+	void Cancel();
+	bool IsCancelled() const;
+
+	// producer side: returns false if the body of a response was already passed on, it cannot be replayed
+	bool StartResponse();
+	// the response is not the requested range: its body is kept aside, where the SDK can parse it
+	void Divert();
+	void Finish();
+
+protected:
+	int_type overflow(int_type c) override;
+	std::streamsize xsputn(const char* s, std::streamsize count) override;
+	int_type underflow() override;
+
+private:
+	mutable std::mutex mutex_;
+	std::condition_variable cond_;
+	Aws::Vector<unsigned char> data_; // ring buffer
+	size_t head_{0};
+	size_t size_{0};
+	bool body_written_{false};
+	bool finished_{false};
+	bool cancelled_{false};
+	bool diverted_{false};
+	Aws::String diverted_data_;
+	size_t diverted_read_{0};
+};
+
+// Body of a GET kept open across the reads of a sequential scan, up to the end of a part
+struct SequentialStream
+{
+	tOffset offset_{0}; // offset in the multifile of the next byte of the stream
+	tOffset end_{0};    // offset in the multifile of the end of the part
+	std::shared_ptr<StreamPipe> pipe_;
+	std::future<SizeOutcome> download_;
+
+	SequentialStream() = default;
+	~SequentialStream()
+	{
+		Close();
+	}
+	SequentialStream(const SequentialStream&) = delete;
+	SequentialStream& operator=(const SequentialStream&) = delete;
+
+	bool IsOpen() const
+	{
+		return pipe_ != nullptr;
+	}
+	// cancel the download and wait for it
+	void Close();
+};
+
+// Name, size and version of a listed object
+struct ListedObject
+{
+	Aws::String key_;
+	tOffset size_{0};
+	Aws::String etag_;
+
+	const Aws::String& GetKey() const { return key_; }
+	tOffset GetSize() const { return size_; }
+	const Aws::String& GetETag() const { return etag_; }
+};
+
+// Names, sizes and versions of a list of objects, in a compact form for the listings of many thousand parts. Each
+// name is stored as the suffix that differs from the previous one, with a whole name every few entries. The ETags of
+// single part uploads, a quoted hexadecimal MD5, are stored as their 16 bytes.
+class ObjectList
+{
+public:
+	void Append(const Aws::String& key, tOffset size, const Aws::String& etag);
+
+	size_t size() const { return sizes_.size(); }
+	bool empty() const { return sizes_.empty(); }
+
+	Aws::String GetKey(size_t i) const;
+	tOffset GetSize(size_t i) const { return sizes_[i]; }
+	Aws::String GetETag(size_t i) const;
+	ListedObject Get(size_t i) const
+	{
+		ListedObject object;
+		object.key_ = GetKey(i);
+		object.size_ = GetSize(i);
+		object.etag_ = GetETag(i);
+		return object;
+	}
+
+	bool operator==(const ObjectList& other) const;
+	bool operator!=(const ObjectList& other) const { return !(*this == other); }
+
+private:
+	enum EtagKind : unsigned char
+	{
+		kNoEtag,
+		kMd5Etag,
+		kOtherEtag
+	};
+
+	static constexpr size_t restart_interval_{16};
+	static constexpr size_t md5_size_{16};
+
+	Aws::Vector<char> key_arena_;
+	Aws::Vector<size_t> key_ends_; // end of the stored suffix of each name in the arena
+	Aws::Vector<unsigned short> shared_lengths_; // length of the prefix shared with the previous name
+	Aws::Vector<tOffset> sizes_;
+	Aws::Vector<unsigned char> etag_kinds_;
+	Aws::Vector<unsigned char> md5_etags_; // md5_size_ bytes per object, zero unless the ETag is an MD5
+	std::unordered_map<size_t, Aws::String> other_etags_;
+};
+
+using ObjectListPtr = std::shared_ptr<const ObjectList>;
+
+// Parts of a file open for reading, as resolved on open. It is not modified afterwards, and the handles that open the
+// same file with the same listing share it.
+struct FileLayout
+{
+	tOffset common_header_length_{0};
+	ObjectList parts_; // names, listed sizes and versions of the parts read, ETags empty if unknown
+	Aws::Vector<tOffset> cumulative_sizes_;
+};
+
+using FileLayoutPtr = std::shared_ptr<const FileLayout>;
+
+// Layouts in use by the open handles, by file. A layout is shared only by the handles that listed the same parts, and
+// an entry lives as long as a handle holds it.
+class LayoutRegistry
+{
+public:
+	FileLayoutPtr Lookup(const Aws::String& key, const ObjectList& parts)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		const auto it = entries_.find(key);
+		FileLayoutPtr shared = it == entries_.end() ? nullptr : it->second.lock();
+		return shared && shared->parts_ == parts ? shared : nullptr;
+	}
+
+	// Returns the layout already registered for the same parts if any, the given one otherwise. A newer listing of
+	// the file replaces the registered layout.
+	FileLayoutPtr Intern(const Aws::String& key, FileLayout layout)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		auto& entry = entries_[key];
+		FileLayoutPtr shared = entry.lock();
+		if (!shared || shared->parts_ != layout.parts_)
+		{
+			shared = std::make_shared<const FileLayout>(std::move(layout));
+			entry = shared;
+		}
+		if (entries_.size() >= next_purge_size_)
+		{
+			EraseExpired();
+			next_purge_size_ = 2 * entries_.size() + min_purge_size_;
+		}
+		return shared;
+	}
+
+	size_t Size()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		EraseExpired();
+		return entries_.size();
+	}
+
+	void Clear()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		entries_.clear();
+		next_purge_size_ = min_purge_size_;
+	}
+
+private:
+	void EraseExpired()
+	{
+		for (auto it = entries_.begin(); it != entries_.end();)
+		{
+			it = it->second.expired() ? entries_.erase(it) : std::next(it);
+		}
+	}
+
+	static constexpr size_t min_purge_size_{64};
+
+	std::mutex mutex_;
+	std::unordered_map<Aws::String, std::weak_ptr<const FileLayout>> entries_;
+	size_t next_purge_size_{min_purge_size_};
+};
+
 struct MultiPartFile
 {
 	Aws::String bucketname_;
 	Aws::String filename_;
 	tOffset offset_{0};
 	// Added for multifile support
-	tOffset common_header_length_{0};
-	Aws::Vector<Aws::String> filenames_;
-	Aws::Vector<tOffset> cumulative_sizes_;
+	FileLayoutPtr layout_;
 	tOffset total_size_{0};
+	ReadAheadWindow read_ahead_;
+	SequentialStream stream_;
+	SequentialStream next_part_stream_; // opened ahead of the end of the part of stream_
+	RandomAccessWindow random_access_;
+	// lazy open: layout once the common header is checked, until then only the first part is visible
+	std::shared_future<SimpleOutcome<FileLayoutPtr>> pending_layout_;
+	std::mutex header_mutex_; // the header check may be applied by concurrent driver_pread calls
+	Aws::Vector<unsigned char> first_block_; // fetched on open, served until a read goes past it
+	AccessHint access_hint_{AccessHint::kNormal};
+	PrefetchedRanges prefetched_;
 
 	MultiPartFile() = default;
-	explicit MultiPartFile(Aws::String bucket, Aws::String filename, tOffset offset, tOffset common_header_length,
-			       Aws::Vector<Aws::String> filenames, Aws::Vector<tOffset> cumulative_sizes)
-	    : bucketname_{std::move(bucket)}, filename_{std::move(filename)}, offset_{offset},
-	      common_header_length_{common_header_length}, filenames_{std::move(filenames)},
-	      cumulative_sizes_{std::move(cumulative_sizes)}, total_size_{cumulative_sizes_.back()}
+	explicit MultiPartFile(Aws::String bucket, Aws::String filename, FileLayoutPtr layout)
+	    : bucketname_{std::move(bucket)}, filename_{std::move(filename)}, layout_{std::move(layout)},
+	      total_size_{layout_->cumulative_sizes_.back()}
 	{
 	}
 };
 
+// Read started by driver_freadAsync, one download per stripe
+struct PendingRead
+{
+	const void* stream_{nullptr};
+	Aws::Vector<std::future<SizeOutcome>> pieces_;
+	Aws::Vector<tOffset> piece_lengths_;
+};
+
 using Parts = Aws::Vector<Aws::S3::Model::CompletedPart>;
 
 struct WriteFile
@@ -59,8 +705,9 @@ struct WriteFile
 	int part_tracker_{1};
 
 	WriteFile() = default;
-	WriteFile(Aws::S3::Model::CreateMultipartUploadResult&& create_upload_result)
-	    : writer_{std::move(create_upload_result)}, bucketname_{writer_.GetBucket()}, filename_{writer_.GetKey()}
+	// the upload is created with the first part, once the header of the file is known
+	WriteFile(Aws::String bucket, Aws::String filename)
+	    : bucketname_{std::move(bucket)}, filename_{std::move(filename)}
 	{
 		buffer_.reserve(buff_min_);
 	}
@@ -120,6 +767,10 @@ extern "C"
 	VISIBLE void* test_getActiveWriterHandles();
 
 	VISIBLE bool test_compareFiles(const char* local_file_path, const char* s3_uri);
+
+	VISIBLE void test_setReadConfig(const s3plugin::ReadConfig& config);
+
+	VISIBLE size_t test_getDiskCacheUsage();
 	
 #ifdef __cplusplus
 } /* extern "C" */
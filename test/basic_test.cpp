@@ -5,9 +5,16 @@
 // Use mocking examples from
 // https://github.com/aws/aws-sdk-cpp/blob/main/tests/aws-cpp-sdk-s3-unit-tests/S3UnitTests.cpp
 #include <aws/core/Aws.h>
+#include <aws/core/utils/HashingUtils.h>
+#include <aws/core/http/standard/StandardHttpRequest.h>
+#include <aws/core/http/standard/StandardHttpResponse.h>
 #include <aws/s3/S3Client.h>
+#include <aws/s3/model/CompleteMultipartUploadRequest.h>
+#include <aws/s3/model/CreateMultipartUploadRequest.h>
 #include <aws/s3/model/GetObjectRequest.h>
 #include <aws/s3/model/GetObjectResult.h>
+#include <aws/s3/model/HeadBucketRequest.h>
+#include <aws/s3/model/UploadPartRequest.h>
 
 #include <boost/process/environment.hpp>
 
@@ -19,21 +26,30 @@
 #include <gtest/gtest.h>
 
 #include <algorithm>
+#include <atomic>
+#include <cstdio>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <mutex>
+#include <random>
 #include <sstream>
+#include <thread>
 
 using namespace s3plugin;
 
 void TestPatternMatching(const std::vector<std::string> &must_match,
                          const std::vector<std::string> &no_match,
                          const std::string &pattern) {
+  const utils::GlobMatcher matcher{pattern};
   for (auto &s : must_match) {
     ASSERT_TRUE(utils::gitignore_glob_match(s, pattern));
+    ASSERT_TRUE(matcher.Match(s));
   }
 
   for (auto &s : no_match) {
     ASSERT_FALSE(utils::gitignore_glob_match(s, pattern));
+    ASSERT_FALSE(matcher.Match(s));
   }
 }
 
@@ -128,6 +144,30 @@ TEST(S3DriverMatchingUtilityTest, DoubleStarWildCard) {
   DO_PATTERN_MATCHING_TEST;
 }
 
+TEST(S3DriverMatchingUtilityTest, CompiledMatcher_SameAsReference) {
+  // random patterns and texts over a small alphabet, so that they often match
+  std::mt19937 random(1234);
+  const std::string pattern_chars = "ab./*?[]-!^\\";
+  const std::string text_chars = "ab./-";
+  auto make_string = [&](const std::string &chars, size_t max_length) {
+    std::string result(random() % (max_length + 1), ' ');
+    for (auto &c : result) {
+      c = chars[random() % chars.size()];
+    }
+    return result;
+  };
+
+  for (int p = 0; p < 2000; p++) {
+    const std::string pattern = make_string(pattern_chars, 8);
+    const utils::GlobMatcher matcher{pattern};
+    for (int t = 0; t < 50; t++) {
+      const std::string text = make_string(text_chars, 10);
+      ASSERT_EQ(matcher.Match(text), utils::gitignore_glob_match(text, pattern))
+          << "pattern " << pattern << ", text " << text;
+    }
+  }
+}
+
 TEST(S3DriverTest, GetDriverName) {
   ASSERT_STREQ(driver_getDriverName(), "S3 driver");
 }
@@ -157,6 +197,15 @@ TEST(S3DriverTest, Disconnect) {
   ASSERT_EQ(driver_isConnected(), kFalse);
 }
 
+TEST(S3DriverTest, DisconnectTwice) {
+  ASSERT_EQ(driver_connect(), kSuccess);
+  ASSERT_EQ(driver_disconnect(), kSuccess);
+
+  // without a client, there is nothing left to stop
+  ASSERT_EQ(driver_disconnect(), kSuccess);
+  ASSERT_EQ(driver_isConnected(), kFalse);
+}
+
 TEST(S3DriverTest, GetFileSize) {
   ASSERT_EQ(driver_connect(), kSuccess);
   ASSERT_EQ(
@@ -255,6 +304,8 @@ TEST(S3DriverTest, GetSystemPreferredBufferSize) {
 using namespace Aws::S3;
 using namespace Aws::S3::Model;
 
+using ::testing::_;
+using ::testing::Invoke;
 using ::testing::Return;
 
 class MockS3Client : public S3Client {
@@ -267,15 +318,29 @@ public:
   MOCK_METHOD(HeadObjectOutcome, HeadObject, (const HeadObjectRequest &request),
               (const));
 
+  MOCK_METHOD(HeadBucketOutcome, HeadBucket, (const HeadBucketRequest &request),
+              (const));
+
   MOCK_METHOD(ListObjectsV2Outcome, ListObjectsV2,
               (const ListObjectsV2Request &request), (const));
+
+  MOCK_METHOD(CreateMultipartUploadOutcome, CreateMultipartUpload,
+              (const CreateMultipartUploadRequest &request), (const));
+
+  MOCK_METHOD(UploadPartOutcome, UploadPart,
+              (const UploadPartRequest &request), (const));
+
+  MOCK_METHOD(CompleteMultipartUploadOutcome, CompleteMultipartUpload,
+              (const CompleteMultipartUploadRequest &request), (const));
 };
 
 template <typename T> T MakeOutcomeError() { return S3Error{}; }
 
-HeadObjectOutcome MakeHeadObjectOutcome(long long value) {
+HeadObjectOutcome MakeHeadObjectOutcome(long long value,
+                                        const Aws::String &etag = "") {
   HeadObjectResult res;
   res.SetContentLength(value);
+  res.SetETag(etag);
   return res;
 }
 
@@ -304,7 +369,8 @@ Aws::Vector<Object> MakeObjectVector(Aws::Vector<Aws::String> &&keys,
   return res;
 }
 
-GetObjectOutcome MakeGetObjectOutcome(const Aws::String &body) {
+GetObjectOutcome MakeGetObjectOutcome(const Aws::String &body,
+                                      const Aws::String &content_range = "") {
 
   auto stream = Aws::MakeUnique<Aws::StringStream>("S3_TEST");
   *stream << body;
@@ -313,6 +379,64 @@ GetObjectOutcome MakeGetObjectOutcome(const Aws::String &body) {
   GetObjectResult res;
   res.ReplaceBody(stream.release()); // according to the API doc,
                                      // GetObjectResult takes ownership
+  res.SetContentRange(content_range);
+  return res;
+}
+
+// serves the byte range of the request, or the whole body if no range is set
+GetObjectOutcome MakeRangedGetObjectOutcome(const Aws::String &body,
+                                            const GetObjectRequest &request) {
+  const Aws::String &range = request.GetRange();
+  if (range.empty()) {
+    return MakeGetObjectOutcome(body);
+  }
+  long long start = 0;
+  long long end = 0;
+  std::sscanf(range.c_str(), "bytes=%lld-%lld", &start, &end);
+  end = std::min(end, static_cast<long long>(body.size()) - 1);
+  return MakeGetObjectOutcome(
+      body.substr(static_cast<size_t>(start), static_cast<size_t>(end - start + 1)),
+      "bytes " + std::to_string(start) + "-" + std::to_string(end) + "/" +
+          std::to_string(body.size()));
+}
+
+// serves a response the way the SDK does: the body goes to the stream made by
+// the factory of the request, once the headers handler has seen the response
+// and as long as the continue handler agrees
+Aws::IOStream *SendResponseBody(const GetObjectRequest &request,
+                                Aws::Http::HttpResponseCode code,
+                                const Aws::String &data) {
+  Aws::IOStream *stream = request.GetResponseStreamFactory()();
+  auto http_request = Aws::MakeShared<Aws::Http::Standard::StandardHttpRequest>(
+      "S3_TEST", Aws::Http::URI("https://bucket.s3.amazonaws.com/name"),
+      Aws::Http::HttpMethod::HTTP_GET);
+  Aws::Http::Standard::StandardHttpResponse response(http_request);
+  response.SetResponseCode(code);
+  if (request.GetHeadersReceivedEventHandler()) {
+    request.GetHeadersReceivedEventHandler()(http_request.get(), &response);
+  }
+  if (!request.GetContinueRequestHandler() ||
+      request.GetContinueRequestHandler()(http_request.get())) {
+    stream->write(data.data(), static_cast<std::streamsize>(data.size()));
+  }
+  return stream;
+}
+
+// serves the byte range of the request through its response stream factory
+GetObjectOutcome MakeFactoryGetObjectOutcome(const Aws::String &body,
+                                             const GetObjectRequest &request) {
+  long long start = 0;
+  long long end = 0;
+  std::sscanf(request.GetRange().c_str(), "bytes=%lld-%lld", &start, &end);
+  end = std::min(end, static_cast<long long>(body.size()) - 1);
+
+  GetObjectResult res;
+  res.ReplaceBody(SendResponseBody(
+      request, Aws::Http::HttpResponseCode::PARTIAL_CONTENT,
+      body.substr(static_cast<size_t>(start),
+                  static_cast<size_t>(end - start + 1))));
+  res.SetContentRange("bytes " + std::to_string(start) + "-" +
+                      std::to_string(end) + "/" + std::to_string(body.size()));
   return res;
 }
 
@@ -363,6 +487,10 @@ protected:
     auto mock_client_alias = Aws::UniquePtr<S3Client>(concrete_mock);
     mock_client_ = dynamic_cast<MockS3Client *>(concrete_mock);
     test_setClient(std::move(mock_client_alias));
+
+    // writers check their bucket on open
+    ON_CALL(*mock_client_, HeadBucket(_))
+        .WillByDefault(Return(HeadBucketOutcome(HeadBucketResult{})));
   }
 
   void TearDown() override {
@@ -471,6 +599,8 @@ public:
 #define GETOBJECT_FAILURE CALL_FAILURE(GetObjectOutcome)
 
 #define HEADOBJECT_CALL(length) CALL_ONCE(MakeHeadObjectOutcome((length)))
+#define HEADOBJECT_CALL_ETAG(length, etag)                                     \
+  CALL_ONCE(MakeHeadObjectOutcome((length), (etag)))
 
 #define LIST_CALL(content, token)                                              \
   CALL_ONCE(MakeListObjectOutcome(std::move((content)), std::move((token))))
@@ -652,6 +782,1706 @@ TEST_F(S3DriverTestFixture,
   GetFileSize_Pattern_OK(expected_size);
 }
 
+TEST_F(S3DriverTestFixture, GetFileSize_Pattern_LongHeader_RangedProbes_OK) {
+  const Aws::String key_0 = MakeKeyFromPatternStub('0');
+  const Aws::String key_1 = MakeKeyFromPatternStub('1');
+
+  // longer than the first probe, so that the probe has to grow
+  const Aws::String header = Aws::String(100 * 1024, 'h') + "\n";
+  const Aws::String body_0 = header + "content";
+  const Aws::String body_1 = header + "more content";
+
+  const long long expected_size =
+      static_cast<long long>(body_0.size() + body_1.size() - header.size());
+
+  auto content =
+      MakeObjectVector({key_0, key_1}, {static_cast<long long>(body_0.size()),
+                                        static_cast<long long>(body_1.size())});
+  Aws::String token;
+
+  // list
+  SIMPLE_LIST_CALL;
+
+  // read header: only ranged requests, two probes for the first part and the
+  // exact length of the header for the second one
+  Aws::Vector<Aws::String> ranges;
+  EXPECT_GETOBJECT.Times(3).WillRepeatedly(
+      Invoke([&](const GetObjectRequest &request) {
+        ranges.push_back(request.GetRange());
+        return MakeRangedGetObjectOutcome(
+            request.GetKey() == key_0 ? body_0 : body_1, request);
+      }));
+
+  GetFileSize_Pattern_OK(expected_size);
+
+  // the second probe is clamped to the object size
+  const Aws::Vector<Aws::String> expected_ranges{
+      "bytes=0-65535", "bytes=65536-102407", "bytes=0-102400"};
+  ASSERT_EQ(ranges, expected_ranges);
+}
+
+TEST_F(S3DriverTestFixture, GetFileSize_Pattern_ManyParts_OneDifferentHeader_OK) {
+  const Aws::String header = "header\n";
+  Aws::Vector<Aws::String> keys;
+  Aws::Vector<long long> sizes;
+  Aws::Map<Aws::String, Aws::String> bodies;
+  long long expected_size = 0;
+  for (char i = '0'; i <= '5'; i++) {
+    const Aws::String key = MakeKeyFromPatternStub(i);
+    // the headers of the parts are checked concurrently, one of them differs
+    const Aws::String body =
+        (i == '3' ? Aws::String("other\n") : header) + "content " + key;
+    keys.push_back(key);
+    sizes.push_back(static_cast<long long>(body.size()));
+    bodies[key] = body;
+    expected_size += static_cast<long long>(body.size());
+  }
+
+  auto content = MakeObjectVector(std::move(keys), std::move(sizes));
+  Aws::String token;
+
+  // list
+  SIMPLE_LIST_CALL;
+
+  // read header
+  EXPECT_GETOBJECT.WillRepeatedly(Invoke([&](const GetObjectRequest &request) {
+    return MakeRangedGetObjectOutcome(bodies.at(request.GetKey()), request);
+  }));
+
+  GetFileSize_Pattern_OK(expected_size);
+}
+
+TEST_F(S3DriverTestFixture, Write_MissingBucket_Failure) {
+  // the bucket is checked on open, the upload is never created
+  EXPECT_CALL(*mock_client_, HeadBucket)
+      .WillOnce(Return(
+          HeadBucketOutcome(S3Error(S3Errors::NO_SUCH_BUCKET, false))));
+  EXPECT_CALL(*mock_client_, CreateMultipartUpload).Times(0);
+
+  ASSERT_EQ(driver_fopen(one_file_, 'w'), nullptr);
+  ASSERT_STRNE(driver_getlasterror(), NULL);
+}
+
+TEST_F(S3DriverTestFixture, Write_HeaderMetadata_OK) {
+  const Aws::String header = "header\n";
+  const Aws::String body = header + "content";
+
+  // the upload is created with the first part, it describes the header
+  EXPECT_CALL(*mock_client_, CreateMultipartUpload)
+      .WillOnce(Invoke([&](const CreateMultipartUploadRequest &request) {
+        const auto &metadata = request.GetMetadata();
+        EXPECT_EQ(metadata.at("khiops-header-length"),
+                  std::to_string(header.size()));
+        EXPECT_EQ(metadata.at("khiops-header-sha256"),
+                  Aws::Utils::HashingUtils::HexEncode(
+                      Aws::Utils::HashingUtils::CalculateSHA256(header)));
+        CreateMultipartUploadResult res;
+        res.SetBucket(request.GetBucket());
+        res.SetKey(request.GetKey());
+        res.SetUploadId("upload_id");
+        return CreateMultipartUploadOutcome(std::move(res));
+      }));
+  EXPECT_CALL(*mock_client_, UploadPart)
+      .WillOnce(Return(UploadPartOutcome(UploadPartResult{})));
+  EXPECT_CALL(*mock_client_, CompleteMultipartUpload)
+      .WillOnce(Return(
+          CompleteMultipartUploadOutcome(CompleteMultipartUploadResult{})));
+
+  void *stream = driver_fopen(one_file_, 'w');
+  ASSERT_NE(stream, nullptr);
+  ASSERT_EQ(driver_fwrite(body.data(), 1, body.size(), stream),
+            static_cast<long long>(body.size()));
+  ASSERT_EQ(driver_fclose(stream), kCloseSuccess);
+}
+
+TEST_F(S3DriverTestFixture, GetFileSize_Pattern_HeaderMetadata_OK) {
+  const Aws::String key_0 = MakeKeyFromPatternStub('0');
+  const Aws::String key_1 = MakeKeyFromPatternStub('1');
+
+  const Aws::String header = "header\n";
+  const Aws::String body_0 = header + "content";
+  const Aws::String body_1 = header + "more content";
+
+  const long long expected_size =
+      static_cast<long long>(body_0.size() + body_1.size() - header.size());
+
+  auto content =
+      MakeObjectVector({key_0, key_1}, {static_cast<long long>(body_0.size()),
+                                        static_cast<long long>(body_1.size())});
+  Aws::String token;
+  SIMPLE_LIST_CALL;
+
+  // the header of the first part is read, the second part is described by
+  // its metadata
+  Aws::Map<Aws::String, Aws::String> metadata;
+  EXPECT_CALL(*mock_client_, CreateMultipartUpload)
+      .WillOnce(Invoke([&](const CreateMultipartUploadRequest &request) {
+        metadata = request.GetMetadata();
+        CreateMultipartUploadResult res;
+        res.SetUploadId("upload_id");
+        return CreateMultipartUploadOutcome(std::move(res));
+      }));
+  EXPECT_CALL(*mock_client_, UploadPart)
+      .WillOnce(Return(UploadPartOutcome(UploadPartResult{})));
+  EXPECT_CALL(*mock_client_, CompleteMultipartUpload)
+      .WillOnce(Return(
+          CompleteMultipartUploadOutcome(CompleteMultipartUploadResult{})));
+  void *stream = driver_fopen(one_file_, 'w');
+  ASSERT_NE(stream, nullptr);
+  ASSERT_EQ(driver_fwrite(body_1.data(), 1, body_1.size(), stream),
+            static_cast<long long>(body_1.size()));
+  ASSERT_EQ(driver_fclose(stream), kCloseSuccess);
+
+  EXPECT_GETOBJECT.WillOnce(Invoke([&](const GetObjectRequest &request) {
+    auto outcome = MakeRangedGetObjectOutcome(body_0, request);
+    outcome.GetResult().SetMetadata(metadata);
+    return outcome;
+  }));
+  EXPECT_HEADOBJECT.WillOnce(Invoke([&](const HeadObjectRequest &) {
+    auto outcome = MakeHeadObjectOutcome(
+        static_cast<long long>(body_1.size()));
+    outcome.GetResult().SetMetadata(metadata);
+    return outcome;
+  }));
+
+  GetFileSize_Pattern_OK(expected_size);
+}
+
+TEST_F(S3DriverTestFixture, GetFileSize_Pattern_HeaderFromListing_OK) {
+  const Aws::String key_0 = MakeKeyFromPatternStub('0');
+  const Aws::String key_1 = MakeKeyFromPatternStub('1');
+  const Aws::String key_2 = MakeKeyFromPatternStub('2');
+
+  const Aws::String header = "header\n";
+  const Aws::String body_0 = header + "content";
+  const Aws::String body_1 = header + "more content";
+
+  // the third part is a copy of the first one
+  const long long expected_size = static_cast<long long>(
+      2 * body_0.size() + body_1.size() - 2 * header.size());
+
+  auto content =
+      MakeObjectVector({key_0, key_1, key_2},
+                       {static_cast<long long>(body_0.size()),
+                        static_cast<long long>(body_1.size()),
+                        static_cast<long long>(body_0.size())});
+  content[0].SetETag("\"etag_0\"");
+  content[1].SetETag("\"etag_1\"");
+  content[2].SetETag("\"etag_0\"");
+  Aws::String token;
+  SIMPLE_LIST_CALL;
+
+  // the header of the first part is read, only the length of the header is
+  // read from the second part and the third part is resolved by its ETag
+  EXPECT_HEADOBJECT.Times(0);
+  EXPECT_GETOBJECT
+      .WillOnce(Invoke([&](const GetObjectRequest &request) {
+        EXPECT_EQ(request.GetKey(), key_0);
+        return MakeRangedGetObjectOutcome(body_0, request);
+      }))
+      .WillOnce(Invoke([&](const GetObjectRequest &request) {
+        EXPECT_EQ(request.GetKey(), key_1);
+        EXPECT_EQ(request.GetRange(), "bytes=0-6");
+        EXPECT_EQ(request.GetIfMatch(), "\"etag_1\"");
+        return MakeRangedGetObjectOutcome(body_1, request);
+      }));
+
+  GetFileSize_Pattern_OK(expected_size);
+}
+
+TEST_F(S3DriverTestFixture, GetFileSize_Pattern_PartShorterThanHeader_OK) {
+  const Aws::String key_0 = MakeKeyFromPatternStub('0');
+  const Aws::String key_1 = MakeKeyFromPatternStub('1');
+
+  const Aws::String body_0 = "header\ncontent";
+
+  // the second part cannot start with the header, it is not downloaded
+  auto content = MakeObjectVector(
+      {key_0, key_1}, {static_cast<long long>(body_0.size()), 3});
+  Aws::String token;
+  SIMPLE_LIST_CALL;
+
+  EXPECT_GETOBJECT.WillOnce(Invoke([&](const GetObjectRequest &request) {
+    return MakeRangedGetObjectOutcome(body_0, request);
+  }));
+
+  GetFileSize_Pattern_OK(static_cast<long long>(body_0.size()) + 3);
+}
+
+TEST_F(S3DriverTestFixture, MetadataCache_InvalidatedByWrite_OK) {
+  const Aws::String body = "header\ncontent";
+
+  // not found, then found once written by the driver
+  EXPECT_HEADOBJECT
+  CALL_ONCE(HeadObjectOutcome(S3Error(S3Errors::RESOURCE_NOT_FOUND, false)))
+  HEADOBJECT_CALL(static_cast<long long>(body.size()));
+
+  EXPECT_CALL(*mock_client_, CreateMultipartUpload)
+      .WillOnce(Invoke([&](const CreateMultipartUploadRequest &) {
+        CreateMultipartUploadResult res;
+        res.SetUploadId("upload_id");
+        return CreateMultipartUploadOutcome(std::move(res));
+      }));
+  EXPECT_CALL(*mock_client_, UploadPart)
+      .WillOnce(Return(UploadPartOutcome(UploadPartResult{})));
+  EXPECT_CALL(*mock_client_, CompleteMultipartUpload)
+      .WillOnce(Return(
+          CompleteMultipartUploadOutcome(CompleteMultipartUploadResult{})));
+
+  // the missing file is remembered
+  ASSERT_EQ(driver_fileExists(one_file_), kFalse);
+  ASSERT_EQ(driver_fileExists(one_file_), kFalse);
+
+  void *stream = driver_fopen(one_file_, 'w');
+  ASSERT_NE(stream, nullptr);
+  ASSERT_EQ(driver_fwrite(body.data(), 1, body.size(), stream),
+            static_cast<long long>(body.size()));
+  ASSERT_EQ(driver_fclose(stream), kCloseSuccess);
+
+  // the write invalidated the entry, the new metadata is then remembered
+  ASSERT_EQ(driver_fileExists(one_file_), kTrue);
+  ASSERT_EQ(driver_getFileSize(one_file_),
+            static_cast<long long>(body.size()));
+}
+
+TEST_F(S3DriverTestFixture, Read_OpenFetch_NoHead_OK) {
+  Aws::String body;
+  for (int i = 0; i < 100; i++) {
+    body += std::to_string(i) + ';';
+  }
+  const long long body_size = static_cast<long long>(body.size());
+
+  ReadConfig config;
+  config.open_fetch_size_ = 64;
+  config.random_min_fetch_ = 0;
+  config.stripe_size_ = 0;
+  test_setReadConfig(config);
+
+  // the size comes with the first block, the metadata is then known
+  EXPECT_HEADOBJECT.Times(0);
+  Aws::Vector<Aws::String> ranges;
+  EXPECT_GETOBJECT.Times(2).WillRepeatedly(
+      Invoke([&](const GetObjectRequest &request) {
+        ranges.push_back(request.GetRange());
+        return MakeRangedGetObjectOutcome(body, request);
+      }));
+
+  void *stream = driver_fopen(one_file_, 'r');
+  ASSERT_NE(stream, nullptr);
+  ASSERT_EQ(driver_getFileSize(one_file_), body_size);
+
+  // reads within the first block need no request
+  std::vector<char> buffer(body.size());
+  ASSERT_EQ(driver_fread(buffer.data(), 1, 30, stream), 30);
+  ASSERT_EQ(driver_fread(buffer.data() + 30, 1, 30, stream), 30);
+  ASSERT_EQ(ranges.size(), 1U);
+
+  // the rest of the object is read normally
+  const long long rest = body_size - 60;
+  ASSERT_EQ(driver_fread(buffer.data() + 60, 1, static_cast<size_t>(rest), stream),
+            rest);
+  ASSERT_EQ(Aws::String(buffer.data(), buffer.size()), body);
+  ASSERT_EQ(ranges[0], "bytes=0-63");
+  ASSERT_EQ(ranges[1], "bytes=60-" + std::to_string(body_size - 1));
+
+  ASSERT_EQ(driver_fclose(stream), kCloseSuccess);
+}
+
+TEST_F(S3DriverTestFixture, Read_OpenFetch_EmptyObject_OK) {
+  ReadConfig config;
+  config.open_fetch_size_ = 64;
+  test_setReadConfig(config);
+
+  // an empty object has no range to serve, its size comes from a HEAD
+  EXPECT_GETOBJECT.WillOnce(Invoke([](const GetObjectRequest &) {
+    S3Error error(S3Errors::UNKNOWN, false);
+    error.SetResponseCode(
+        Aws::Http::HttpResponseCode::REQUESTED_RANGE_NOT_SATISFIABLE);
+    return GetObjectOutcome(error);
+  }));
+  EXPECT_HEADOBJECT.WillOnce(Return(MakeHeadObjectOutcome(0)));
+
+  void *stream = driver_fopen(one_file_, 'r');
+  ASSERT_NE(stream, nullptr);
+  std::vector<char> buffer(10);
+  ASSERT_EQ(driver_fread(buffer.data(), 1, 0, stream), 0);
+  ASSERT_EQ(driver_fclose(stream), kCloseSuccess);
+}
+
+TEST_F(S3DriverTestFixture, Read_OpenFetch_MissingObject_Failure) {
+  ReadConfig config;
+  config.open_fetch_size_ = 64;
+  test_setReadConfig(config);
+
+  // the error of the GET is reported, no HEAD is sent
+  EXPECT_GETOBJECT.WillOnce(Invoke([](const GetObjectRequest &) {
+    S3Error error(S3Errors::NO_SUCH_KEY, false);
+    error.SetResponseCode(Aws::Http::HttpResponseCode::NOT_FOUND);
+    return GetObjectOutcome(error);
+  }));
+  EXPECT_HEADOBJECT.Times(0);
+
+  ASSERT_EQ(driver_fopen(one_file_, 'r'), nullptr);
+  ASSERT_STRNE(driver_getlasterror(), NULL);
+}
+
+TEST_F(S3DriverTestFixture, SingleFlight_ConcurrentHead_OK) {
+  constexpr long long length = 1000;
+
+  // without the metadata cache, only the single-flight layer joins the calls
+  ReadConfig config;
+  config.metadata_ttl_ms_ = 0;
+  test_setReadConfig(config);
+
+  EXPECT_HEADOBJECT.WillOnce(Invoke([&](const HeadObjectRequest &) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    return MakeHeadObjectOutcome(length);
+  }));
+
+  Aws::Vector<std::thread> threads;
+  Aws::Vector<long long> sizes(4, -1);
+  for (size_t i = 0; i < sizes.size(); i++) {
+    threads.emplace_back(
+        [this, &sizes, i]() { sizes[i] = driver_getFileSize(one_file_); });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  ASSERT_EQ(sizes, Aws::Vector<long long>(sizes.size(), length));
+}
+
+TEST_F(S3DriverTestFixture, Read_InterruptedTransfer_Resumed_OK) {
+  Aws::String body;
+  for (int i = 0; i < 100; i++) {
+    body += std::to_string(i) + ';';
+  }
+  const long long body_size = static_cast<long long>(body.size());
+  const size_t delivered = 100;
+
+  ReadConfig config;
+  config.open_fetch_size_ = 0;
+  config.window_blocks_ = 0;
+  config.random_min_fetch_ = 0;
+  config.stripe_size_ = 0;
+  test_setReadConfig(config);
+
+  EXPECT_HEADOBJECT
+  HEADOBJECT_CALL(body_size);
+
+  // the connection drops after part of the body, the rest is requested
+  Aws::Vector<Aws::String> ranges;
+  EXPECT_GETOBJECT.Times(2).WillRepeatedly(
+      Invoke([&](const GetObjectRequest &request) {
+        ranges.push_back(request.GetRange());
+        if (ranges.size() > 1) {
+          return MakeRangedGetObjectOutcome(body, request);
+        }
+        Aws::IOStream *response_stream = request.GetResponseStreamFactory()();
+        response_stream->write(body.data(), delivered);
+        Aws::Delete(response_stream);
+        S3Error error(S3Errors::NETWORK_CONNECTION, true);
+        error.SetResponseCode(Aws::Http::HttpResponseCode::PARTIAL_CONTENT);
+        return GetObjectOutcome(error);
+      }));
+
+  void *stream = driver_fopen(one_file_, 'r');
+  ASSERT_NE(stream, nullptr);
+
+  std::vector<char> buffer(body.size());
+  ASSERT_EQ(driver_fread(buffer.data(), 1, buffer.size(), stream), body_size);
+  ASSERT_EQ(Aws::String(buffer.data(), buffer.size()), body);
+  ASSERT_EQ(ranges[1], "bytes=" + std::to_string(delivered) + "-" +
+                           std::to_string(body_size - 1));
+
+  ASSERT_EQ(driver_fclose(stream), kCloseSuccess);
+}
+
+TEST_F(S3DriverTestFixture, Read_InterruptedTransfer_SdkRetryRefused_OK) {
+  Aws::String body;
+  for (int i = 0; i < 100; i++) {
+    body += std::to_string(i) + ';';
+  }
+  const long long body_size = static_cast<long long>(body.size());
+  const size_t delivered = 100;
+
+  ReadConfig config;
+  config.open_fetch_size_ = 0;
+  config.window_blocks_ = 0;
+  config.random_min_fetch_ = 0;
+  config.stripe_size_ = 0;
+  test_setReadConfig(config);
+
+  EXPECT_HEADOBJECT
+  HEADOBJECT_CALL(body_size);
+
+  // the connection drops after part of the body and the SDK retries: the
+  // retry would download the whole range again, it is cancelled and only the
+  // rest is requested
+  Aws::Vector<Aws::String> ranges;
+  bool retry_continued = true;
+  EXPECT_GETOBJECT.Times(2).WillRepeatedly(
+      Invoke([&](const GetObjectRequest &request) {
+        ranges.push_back(request.GetRange());
+        if (ranges.size() > 1) {
+          return MakeFactoryGetObjectOutcome(body, request);
+        }
+        Aws::Delete(SendResponseBody(request,
+                                     Aws::Http::HttpResponseCode::PARTIAL_CONTENT,
+                                     body.substr(0, delivered)));
+        Aws::Delete(SendResponseBody(
+            request, Aws::Http::HttpResponseCode::PARTIAL_CONTENT, body));
+        retry_continued = request.GetContinueRequestHandler()(nullptr);
+        return GetObjectOutcome(S3Error(S3Errors::NETWORK_CONNECTION, false));
+      }));
+
+  void *stream = driver_fopen(one_file_, 'r');
+  ASSERT_NE(stream, nullptr);
+
+  std::vector<char> buffer(body.size());
+  ASSERT_EQ(driver_fread(buffer.data(), 1, buffer.size(), stream), body_size);
+  ASSERT_EQ(Aws::String(buffer.data(), buffer.size()), body);
+  ASSERT_FALSE(retry_continued);
+  ASSERT_EQ(ranges[1], "bytes=" + std::to_string(delivered) + "-" +
+                           std::to_string(body_size - 1));
+
+  ASSERT_EQ(driver_fclose(stream), kCloseSuccess);
+}
+
+TEST_F(S3DriverTestFixture, Read_InterruptedTransfer_AfterLastByte_OK) {
+  const Aws::String body = "the whole body arrives before the failure";
+  const long long body_size = static_cast<long long>(body.size());
+
+  ReadConfig config;
+  config.open_fetch_size_ = 0;
+  config.window_blocks_ = 0;
+  config.random_min_fetch_ = 0;
+  config.stripe_size_ = 0;
+  test_setReadConfig(config);
+
+  EXPECT_HEADOBJECT
+  HEADOBJECT_CALL(body_size);
+
+  // nothing is left to request
+  EXPECT_GETOBJECT.WillOnce(Invoke([&](const GetObjectRequest &request) {
+    Aws::Delete(SendResponseBody(
+        request, Aws::Http::HttpResponseCode::PARTIAL_CONTENT, body));
+    S3Error error(S3Errors::NETWORK_CONNECTION, true);
+    error.SetResponseCode(Aws::Http::HttpResponseCode::PARTIAL_CONTENT);
+    return GetObjectOutcome(error);
+  }));
+
+  void *stream = driver_fopen(one_file_, 'r');
+  ASSERT_NE(stream, nullptr);
+
+  std::vector<char> buffer(body.size());
+  ASSERT_EQ(driver_fread(buffer.data(), 1, buffer.size(), stream), body_size);
+  ASSERT_EQ(Aws::String(buffer.data(), buffer.size()), body);
+
+  ASSERT_EQ(driver_fclose(stream), kCloseSuccess);
+}
+
+TEST_F(S3DriverTestFixture, Read_Hedged_SlowRequest_OK) {
+  Aws::String body;
+  for (int i = 0; i < 100; i++) {
+    body += std::to_string(i) + ';';
+  }
+  const long long body_size = static_cast<long long>(body.size());
+
+  ReadConfig config;
+  config.open_fetch_size_ = 0;
+  config.window_blocks_ = 0;
+  config.random_min_fetch_ = 0;
+  config.stripe_size_ = 0;
+  config.hedge_percentile_ = 90;
+  config.hedge_min_delay_ms_ = 20;
+  test_setReadConfig(config);
+
+  EXPECT_HEADOBJECT
+  HEADOBJECT_CALL(body_size);
+
+  // the first requests set the usual latency and are sent directly, then a
+  // request stalls and is duplicated: the duplicate first gets an error, whose
+  // body must not reach the reader, then the range once the SDK retries
+  constexpr int learning_reads = 16;
+  const auto reader_thread = std::this_thread::get_id();
+  std::atomic<int> calls{0};
+  std::atomic<int> direct_calls{0};
+  std::promise<void> release;
+  std::promise<void> released;
+  bool stalled_continued = true;
+  EXPECT_GETOBJECT.Times(learning_reads + 2)
+      .WillRepeatedly(Invoke([&](const GetObjectRequest &request) {
+        const int call = ++calls;
+        if (call <= learning_reads) {
+          if (std::this_thread::get_id() == reader_thread) {
+            direct_calls++;
+          }
+          return MakeFactoryGetObjectOutcome(body, request);
+        }
+        if (call == learning_reads + 2) {
+          Aws::Delete(SendResponseBody(
+              request, Aws::Http::HttpResponseCode::SERVICE_UNAVAILABLE,
+              "<Error><Code>SlowDown</Code></Error>"));
+          return MakeFactoryGetObjectOutcome(body, request);
+        }
+        release.get_future().wait();
+        Aws::Delete(SendResponseBody(
+            request, Aws::Http::HttpResponseCode::PARTIAL_CONTENT,
+            Aws::String(10, 'x')));
+        stalled_continued = request.GetContinueRequestHandler()(nullptr);
+        released.set_value();
+        return GetObjectOutcome(S3Error(S3Errors::NETWORK_CONNECTION, false));
+      }));
+
+  void *stream = driver_fopen(one_file_, 'r');
+  ASSERT_NE(stream, nullptr);
+
+  std::vector<char> buffer(10);
+  for (int i = 0; i <= learning_reads; i++) {
+    const long long offset = (i * 17) % (body_size - 10);
+    ASSERT_EQ(driver_fseek(stream, offset, std::ios::beg), 0);
+    ASSERT_EQ(driver_fread(buffer.data(), 1, buffer.size(), stream), 10);
+    ASSERT_EQ(Aws::String(buffer.data(), buffer.size()),
+              body.substr(static_cast<size_t>(offset), 10));
+  }
+  ASSERT_EQ(calls.load(), learning_reads + 2);
+  ASSERT_EQ(direct_calls.load(), learning_reads);
+
+  // the stalled request is cancelled when it answers, without touching the
+  // reader's buffer
+  const Aws::String read = Aws::String(buffer.data(), buffer.size());
+  release.set_value();
+  released.get_future().wait();
+  ASSERT_FALSE(stalled_continued);
+  ASSERT_EQ(Aws::String(buffer.data(), buffer.size()), read);
+
+  ASSERT_EQ(driver_fclose(stream), kCloseSuccess);
+}
+
+TEST_F(S3DriverTestFixture, Read_Fadvise_OK) {
+  Aws::String body;
+  for (int i = 0; i < 200; i++) {
+    body += std::to_string(i) + ';';
+  }
+  const long long body_size = static_cast<long long>(body.size());
+
+  ReadConfig config;
+  config.open_fetch_size_ = 0;
+  config.stripe_size_ = 0;
+  test_setReadConfig(config);
+
+  EXPECT_HEADOBJECT
+  HEADOBJECT_CALL(body_size);
+
+  std::mutex ranges_mutex;
+  Aws::Vector<Aws::String> ranges;
+  EXPECT_GETOBJECT.Times(2).WillRepeatedly(
+      Invoke([&](const GetObjectRequest &request) {
+        std::lock_guard<std::mutex> lock(ranges_mutex);
+        ranges.push_back(request.GetRange());
+        return MakeRangedGetObjectOutcome(body, request);
+      }));
+
+  void *stream = driver_fopen(one_file_, 'r');
+  ASSERT_NE(stream, nullptr);
+  ASSERT_EQ(driver_fadvise(stream, 0, 0, 42), -1);
+
+  // the announced range is served without another request
+  ASSERT_EQ(driver_prefetch(stream, 100, 100), 0);
+  std::vector<char> buffer(50);
+  ASSERT_EQ(driver_fseek(stream, 120, std::ios::beg), 0);
+  ASSERT_EQ(driver_fread(buffer.data(), 1, buffer.size(), stream), 50);
+  ASSERT_EQ(Aws::String(buffer.data(), buffer.size()), body.substr(120, 50));
+
+  // random access reads exactly what is asked
+  ASSERT_EQ(driver_fadvise(stream, 0, 0, DRIVER_FADV_RANDOM), 0);
+  ASSERT_EQ(driver_fadvise(stream, 100, 100, DRIVER_FADV_DONTNEED), 0);
+  ASSERT_EQ(driver_fseek(stream, 300, std::ios::beg), 0);
+  ASSERT_EQ(driver_fread(buffer.data(), 1, 10, stream), 10);
+  ASSERT_EQ(Aws::String(buffer.data(), 10), body.substr(300, 10));
+
+  const Aws::Vector<Aws::String> expected_ranges{"bytes=100-199",
+                                                 "bytes=300-309"};
+  ASSERT_EQ(ranges, expected_ranges);
+
+  ASSERT_EQ(driver_fclose(stream), kCloseSuccess);
+}
+
+TEST_F(S3DriverTestFixture, Read_Fadvise_BudgetInFlight_OK) {
+  Aws::String body;
+  for (int i = 0; i < 200; i++) {
+    body += std::to_string(i) + ';';
+  }
+  const long long body_size = static_cast<long long>(body.size());
+
+  ReadConfig config;
+  config.open_fetch_size_ = 0;
+  config.stripe_size_ = 0;
+  config.prefetch_budget_ = 100;
+  test_setReadConfig(config);
+
+  EXPECT_HEADOBJECT
+  HEADOBJECT_CALL(body_size);
+
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+  std::mutex ranges_mutex;
+  Aws::Vector<Aws::String> ranges;
+  EXPECT_GETOBJECT.Times(2).WillRepeatedly(
+      Invoke([&, released](const GetObjectRequest &request) {
+        {
+          std::lock_guard<std::mutex> lock(ranges_mutex);
+          ranges.push_back(request.GetRange());
+        }
+        if (request.GetRange() == "bytes=0-99") {
+          released.wait();
+        }
+        return MakeRangedGetObjectOutcome(body, request);
+      }));
+
+  void *stream = driver_fopen(one_file_, 'r');
+  ASSERT_NE(stream, nullptr);
+
+  // the advices return while the first download is stalled: the budget it
+  // holds skips the second prefetch, and its block is not discarded
+  EXPECT_EQ(driver_prefetch(stream, 0, 100), 0);
+  EXPECT_EQ(driver_prefetch(stream, 200, 100), 0);
+  EXPECT_EQ(driver_fadvise(stream, 0, 100, DRIVER_FADV_DONTNEED), 0);
+  release.set_value();
+
+  std::vector<char> buffer(50);
+  ASSERT_EQ(driver_fread(buffer.data(), 1, buffer.size(), stream), 50);
+  ASSERT_EQ(Aws::String(buffer.data(), buffer.size()), body.substr(0, 50));
+
+  // once downloaded, the block makes room for the next prefetch
+  ASSERT_EQ(driver_prefetch(stream, 200, 100), 0);
+  ASSERT_EQ(driver_fseek(stream, 200, std::ios::beg), 0);
+  ASSERT_EQ(driver_fread(buffer.data(), 1, buffer.size(), stream), 50);
+  ASSERT_EQ(Aws::String(buffer.data(), buffer.size()), body.substr(200, 50));
+
+  const Aws::Vector<Aws::String> expected_ranges{"bytes=0-99",
+                                                 "bytes=200-299"};
+  ASSERT_EQ(ranges, expected_ranges);
+
+  ASSERT_EQ(driver_fclose(stream), kCloseSuccess);
+}
+
+TEST_F(S3DriverTestFixture, Readv_MergedRanges_OK) {
+  Aws::String body;
+  for (int i = 0; i < 200; i++) {
+    body += std::to_string(i) + ';';
+  }
+  const long long body_size = static_cast<long long>(body.size());
+
+  ReadConfig config;
+  config.open_fetch_size_ = 0;
+  config.stripe_size_ = 0;
+  config.readv_merge_gap_ = 16;
+  test_setReadConfig(config);
+
+  EXPECT_HEADOBJECT
+  HEADOBJECT_CALL(body_size);
+
+  std::mutex ranges_mutex;
+  Aws::Vector<Aws::String> ranges;
+  EXPECT_GETOBJECT.Times(2).WillRepeatedly(
+      Invoke([&](const GetObjectRequest &request) {
+        std::lock_guard<std::mutex> lock(ranges_mutex);
+        ranges.push_back(request.GetRange());
+        return MakeRangedGetObjectOutcome(body, request);
+      }));
+
+  void *stream = driver_fopen(one_file_, 'r');
+  ASSERT_NE(stream, nullptr);
+
+  // the first two ranges are read together, the last one ends with the file
+  std::vector<char> first(10);
+  std::vector<char> second(10);
+  std::vector<char> last(20);
+  const driver_read_range read_ranges[] = {
+      {body_size - 10, 20, last.data()},
+      {100, 10, first.data()},
+      {115, 10, second.data()}};
+  ASSERT_EQ(driver_freadv(stream, read_ranges, 3), 30);
+  ASSERT_EQ(Aws::String(first.data(), 10), body.substr(100, 10));
+  ASSERT_EQ(Aws::String(second.data(), 10), body.substr(115, 10));
+  ASSERT_EQ(Aws::String(last.data(), 10),
+            body.substr(static_cast<size_t>(body_size - 10)));
+
+  std::sort(ranges.begin(), ranges.end());
+  const Aws::Vector<Aws::String> expected_ranges{
+      "bytes=100-124", "bytes=" + std::to_string(body_size - 10) + "-" +
+                           std::to_string(body_size - 1)};
+  ASSERT_EQ(ranges, expected_ranges);
+
+  ASSERT_EQ(driver_fclose(stream), kCloseSuccess);
+}
+
+TEST_F(S3DriverTestFixture, Readv_OverlappingRanges_OK) {
+  Aws::String body;
+  for (int i = 0; i < 200; i++) {
+    body += std::to_string(i) + ';';
+  }
+  const long long body_size = static_cast<long long>(body.size());
+
+  ReadConfig config;
+  config.open_fetch_size_ = 0;
+  config.stripe_size_ = 0;
+  config.readv_merge_gap_ = 16;
+  config.readv_max_run_ = 32;
+  test_setReadConfig(config);
+
+  EXPECT_HEADOBJECT
+  HEADOBJECT_CALL(body_size);
+
+  std::mutex ranges_mutex;
+  Aws::Vector<Aws::String> ranges;
+  EXPECT_GETOBJECT.Times(2).WillRepeatedly(
+      Invoke([&](const GetObjectRequest &request) {
+        std::lock_guard<std::mutex> lock(ranges_mutex);
+        ranges.push_back(request.GetRange());
+        return MakeRangedGetObjectOutcome(body, request);
+      }));
+
+  void *stream = driver_fopen(one_file_, 'r');
+  ASSERT_NE(stream, nullptr);
+
+  // the overlapping ranges are read together, the third one would make the
+  // run too long
+  std::vector<char> first(20);
+  std::vector<char> second(20);
+  std::vector<char> third(10);
+  const driver_read_range read_ranges[] = {{110, 20, second.data()},
+                                           {100, 20, first.data()},
+                                           {135, 10, third.data()}};
+  ASSERT_EQ(driver_freadv(stream, read_ranges, 3), 50);
+  ASSERT_EQ(Aws::String(first.data(), 20), body.substr(100, 20));
+  ASSERT_EQ(Aws::String(second.data(), 20), body.substr(110, 20));
+  ASSERT_EQ(Aws::String(third.data(), 10), body.substr(135, 10));
+
+  std::sort(ranges.begin(), ranges.end());
+  const Aws::Vector<Aws::String> expected_ranges{"bytes=100-129",
+                                                 "bytes=135-144"};
+  ASSERT_EQ(ranges, expected_ranges);
+
+  ASSERT_EQ(driver_fclose(stream), kCloseSuccess);
+}
+
+TEST_F(S3DriverTestFixture, ReadAsync_Pipelined_OK) {
+  Aws::String body;
+  for (int i = 0; i < 200; i++) {
+    body += std::to_string(i) + ';';
+  }
+  const long long body_size = static_cast<long long>(body.size());
+
+  ReadConfig config;
+  config.open_fetch_size_ = 0;
+  config.stripe_size_ = 0;
+  test_setReadConfig(config);
+
+  EXPECT_HEADOBJECT
+  HEADOBJECT_CALL(body_size);
+  EXPECT_GETOBJECT.Times(2).WillRepeatedly(
+      Invoke([&](const GetObjectRequest &request) {
+        return MakeRangedGetObjectOutcome(body, request);
+      }));
+
+  void *stream = driver_fopen(one_file_, 'r');
+  ASSERT_NE(stream, nullptr);
+
+  // the second read starts where the first one ends, before it completes
+  const size_t first_size = 100;
+  std::vector<char> first(first_size);
+  std::vector<char> rest(body.size());
+  const long long first_token =
+      driver_freadAsync(stream, first.data(), 1, first.size());
+  const long long rest_token =
+      driver_freadAsync(stream, rest.data(), 1, rest.size());
+  ASSERT_GT(first_token, 0);
+  ASSERT_GT(rest_token, 0);
+  ASSERT_NE(first_token, rest_token);
+
+  ASSERT_EQ(driver_wait(rest_token), body_size - static_cast<long long>(first_size));
+  ASSERT_EQ(driver_poll(rest_token), -1);
+  ASSERT_EQ(driver_wait(first_token), static_cast<long long>(first_size));
+  ASSERT_EQ(Aws::String(first.data(), first_size), body.substr(0, first_size));
+  ASSERT_EQ(Aws::String(rest.data(), body.size() - first_size),
+            body.substr(first_size));
+
+  // the position moved past both reads
+  ASSERT_EQ(driver_freadAsync(stream, first.data(), 1, 1), -1);
+
+  ASSERT_EQ(driver_fclose(stream), kCloseSuccess);
+}
+
+TEST_F(S3DriverTestFixture, ReadAsync_ZeroCountPastEnd_OK) {
+  Aws::String body;
+  for (int i = 0; i < 200; i++) {
+    body += std::to_string(i) + ';';
+  }
+  const long long body_size = static_cast<long long>(body.size());
+
+  ReadConfig config;
+  config.open_fetch_size_ = 0;
+  config.stripe_size_ = 0;
+  test_setReadConfig(config);
+
+  EXPECT_HEADOBJECT
+  HEADOBJECT_CALL(body_size);
+  EXPECT_GETOBJECT.WillOnce(Invoke([&](const GetObjectRequest &request) {
+    return MakeRangedGetObjectOutcome(body, request);
+  }));
+
+  void *stream = driver_fopen(one_file_, 'r');
+  ASSERT_NE(stream, nullptr);
+
+  // an empty read past the end reads nothing and leaves the position there
+  std::vector<char> buffer(10);
+  ASSERT_EQ(driver_fseek(stream, body_size + 100, std::ios::beg), 0);
+  const long long token = driver_freadAsync(stream, buffer.data(), 1, 0);
+  ASSERT_GT(token, 0);
+  ASSERT_EQ(driver_wait(token), 0);
+  ASSERT_EQ(driver_freadAsync(stream, buffer.data(), 1, 1), -1);
+
+  // back within the file, the position was not moved backwards
+  ASSERT_EQ(driver_fseek(stream, -110, std::ios::cur), 0);
+  const long long last_token =
+      driver_freadAsync(stream, buffer.data(), 1, buffer.size());
+  ASSERT_GT(last_token, 0);
+  ASSERT_EQ(driver_wait(last_token), 10);
+  ASSERT_EQ(Aws::String(buffer.data(), buffer.size()),
+            body.substr(static_cast<size_t>(body_size - 10)));
+
+  ASSERT_EQ(driver_fclose(stream), kCloseSuccess);
+}
+
+TEST_F(S3DriverTestFixture, Pread_ConcurrentThreads_OK) {
+  Aws::String body;
+  for (int i = 0; i < 400; i++) {
+    body += std::to_string(i) + ';';
+  }
+  const long long body_size = static_cast<long long>(body.size());
+
+  ReadConfig config;
+  config.open_fetch_size_ = 0;
+  config.stripe_size_ = 0;
+  test_setReadConfig(config);
+
+  EXPECT_HEADOBJECT
+  HEADOBJECT_CALL(body_size);
+  EXPECT_GETOBJECT.WillRepeatedly(Invoke([&](const GetObjectRequest &request) {
+    return MakeRangedGetObjectOutcome(body, request);
+  }));
+
+  void *stream = driver_fopen(one_file_, 'r');
+  ASSERT_NE(stream, nullptr);
+
+  // each thread reads its own chunk of the same stream
+  const size_t thread_count = 4;
+  const size_t chunk = (body.size() + thread_count - 1) / thread_count;
+  std::vector<std::vector<char>> chunks(thread_count, std::vector<char>(chunk));
+  std::vector<long long> results(thread_count);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < thread_count; i++) {
+    threads.emplace_back([&, i] {
+      results[i] = driver_pread(stream, chunks[i].data(), chunk,
+                                static_cast<long long>(i * chunk));
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  Aws::String read_back;
+  for (size_t i = 0; i < thread_count; i++) {
+    ASSERT_GT(results[i], 0);
+    read_back.append(chunks[i].data(), static_cast<size_t>(results[i]));
+  }
+  ASSERT_EQ(read_back, body);
+
+  // past the end, and the position is left untouched
+  ASSERT_EQ(driver_pread(stream, chunks[0].data(), chunk, body_size), 0);
+  ASSERT_EQ(driver_pread(stream, chunks[0].data(), chunk, -1), -1);
+  std::vector<char> buffer(body.size());
+  ASSERT_EQ(driver_fread(buffer.data(), 1, buffer.size(), stream), body_size);
+
+  ASSERT_EQ(driver_fclose(stream), kCloseSuccess);
+}
+
+TEST_F(S3DriverTestFixture, Read_Sequential_ReadAhead_OK) {
+  Aws::String body;
+  for (int i = 0; i < 1000; i++) {
+    body += std::to_string(i) + ';';
+  }
+
+  // the small object would otherwise be fetched whole on open
+  ReadConfig config;
+  config.open_fetch_size_ = 0;
+  test_setReadConfig(config);
+
+  EXPECT_HEADOBJECT
+  HEADOBJECT_CALL(static_cast<long long>(body.size()));
+  EXPECT_GETOBJECT.WillRepeatedly(Invoke([&](const GetObjectRequest &request) {
+    return MakeRangedGetObjectOutcome(body, request);
+  }));
+
+  void *stream = driver_fopen(one_file_, 'r');
+  ASSERT_NE(stream, nullptr);
+
+  // small sequential reads, the following ones are served by the read-ahead
+  Aws::String read_back;
+  std::vector<char> buffer(97);
+  long long read = 0;
+  while ((read = driver_fread(buffer.data(), 1, buffer.size(), stream)) > 0) {
+    read_back.append(buffer.data(), static_cast<size_t>(read));
+    if (read_back.size() == body.size()) {
+      break;
+    }
+  }
+  ASSERT_EQ(read_back, body);
+
+  // a seek breaks the sequence
+  ASSERT_EQ(driver_fseek(stream, 10, std::ios::beg), 0);
+  ASSERT_EQ(driver_fread(buffer.data(), 1, 5, stream), 5);
+  ASSERT_EQ(Aws::String(buffer.data(), 5), body.substr(10, 5));
+  ASSERT_EQ(driver_fread(buffer.data(), 1, 5, stream), 5);
+  ASSERT_EQ(Aws::String(buffer.data(), 5), body.substr(15, 5));
+
+  ASSERT_EQ(driver_fclose(stream), kCloseSuccess);
+}
+
+TEST_F(S3DriverTestFixture, Read_Sequential_Streaming_OK) {
+  Aws::String body;
+  for (int i = 0; i < 100; i++) {
+    body += std::to_string(i) + ';';
+  }
+  const long long body_size = static_cast<long long>(body.size());
+
+  ReadConfig config;
+  config.streaming_reads_ = 1;
+  config.block_size_ = 16; // the stream goes through a buffer smaller than a read
+  config.stripe_size_ = 0;
+  config.open_fetch_size_ = 0;
+  test_setReadConfig(config);
+
+  EXPECT_HEADOBJECT
+  HEADOBJECT_CALL(body_size);
+
+  // the first read is a ranged request, then the scan uses a single stream
+  Aws::Vector<Aws::String> ranges;
+  EXPECT_GETOBJECT.Times(2).WillRepeatedly(
+      Invoke([&](const GetObjectRequest &request) {
+        ranges.push_back(request.GetRange());
+        return MakeRangedGetObjectOutcome(body, request);
+      }));
+
+  void *stream = driver_fopen(one_file_, 'r');
+  ASSERT_NE(stream, nullptr);
+
+  Aws::String result;
+  std::vector<char> buffer(37);
+  long long read = 0;
+  while ((read = driver_fread(buffer.data(), 1, buffer.size(), stream)) > 0) {
+    result.append(buffer.data(), static_cast<size_t>(read));
+    if (static_cast<long long>(result.size()) == body_size) {
+      break;
+    }
+  }
+  ASSERT_EQ(result, body);
+  ASSERT_EQ(ranges[1], "bytes=37-" + std::to_string(body_size - 1));
+
+  ASSERT_EQ(driver_fclose(stream), kCloseSuccess);
+}
+
+TEST_F(S3DriverTestFixture, Read_Streaming_ErrorResponse_FallsBack_OK) {
+  Aws::String body;
+  for (int i = 0; i < 100; i++) {
+    body += std::to_string(i) + ';';
+  }
+  const long long body_size = static_cast<long long>(body.size());
+
+  ReadConfig config;
+  config.streaming_reads_ = 1;
+  config.block_size_ = 16;
+  config.stripe_size_ = 0;
+  config.open_fetch_size_ = 0;
+  test_setReadConfig(config);
+
+  EXPECT_HEADOBJECT
+  HEADOBJECT_CALL(body_size);
+
+  // the streams run on their own thread: the first one gets an error whose
+  // body must not reach the reader, the second one drops after a few bytes,
+  // and the reads go on with ranged requests in both cases
+  const auto reader_thread = std::this_thread::get_id();
+  std::mutex calls_mutex;
+  int streams = 0;
+  EXPECT_GETOBJECT.WillRepeatedly(Invoke([&](const GetObjectRequest &request) {
+    if (std::this_thread::get_id() == reader_thread) {
+      return MakeFactoryGetObjectOutcome(body, request);
+    }
+    int stream_index = 0;
+    {
+      std::lock_guard<std::mutex> lock(calls_mutex);
+      stream_index = ++streams;
+    }
+    if (stream_index == 1) {
+      Aws::Delete(SendResponseBody(
+          request, Aws::Http::HttpResponseCode::SERVICE_UNAVAILABLE,
+          "<Error><Code>SlowDown</Code></Error>"));
+      S3Error error(S3Errors::SERVICE_UNAVAILABLE, false);
+      error.SetResponseCode(Aws::Http::HttpResponseCode::SERVICE_UNAVAILABLE);
+      return GetObjectOutcome(error);
+    }
+    if (stream_index == 2) {
+      long long start = 0;
+      std::sscanf(request.GetRange().c_str(), "bytes=%lld-", &start);
+      Aws::Delete(SendResponseBody(
+          request, Aws::Http::HttpResponseCode::PARTIAL_CONTENT,
+          body.substr(static_cast<size_t>(start), 10)));
+      S3Error error(S3Errors::NETWORK_CONNECTION, true);
+      error.SetResponseCode(Aws::Http::HttpResponseCode::PARTIAL_CONTENT);
+      return GetObjectOutcome(error);
+    }
+    return MakeFactoryGetObjectOutcome(body, request);
+  }));
+
+  void *stream = driver_fopen(one_file_, 'r');
+  ASSERT_NE(stream, nullptr);
+
+  Aws::String result;
+  std::vector<char> buffer(37);
+  long long read = 0;
+  while ((read = driver_fread(buffer.data(), 1, buffer.size(), stream)) > 0) {
+    result.append(buffer.data(), static_cast<size_t>(read));
+    if (static_cast<long long>(result.size()) == body_size) {
+      break;
+    }
+  }
+  ASSERT_EQ(result, body);
+  {
+    std::lock_guard<std::mutex> lock(calls_mutex);
+    ASSERT_GE(streams, 2);
+  }
+
+  ASSERT_EQ(driver_fclose(stream), kCloseSuccess);
+}
+
+TEST_F(S3DriverTestFixture, Read_Streaming_NextPartPrefetch_OK) {
+  const Aws::String key_0 = MakeKeyFromPatternStub('0');
+  const Aws::String key_1 = MakeKeyFromPatternStub('1');
+
+  const Aws::String header = "header\n";
+  Aws::String content0;
+  Aws::String content1;
+  for (int i = 0; i < 50; i++) {
+    content0 += std::to_string(i) + ';';
+    content1 += std::to_string(100 + i) + ';';
+  }
+  const Aws::String body_0 = header + content0;
+  const Aws::String body_1 = header + content1;
+  const Aws::String expected = body_0 + content1;
+
+  auto content =
+      MakeObjectVector({key_0, key_1}, {static_cast<long long>(body_0.size()),
+                                        static_cast<long long>(body_1.size())});
+  Aws::String token;
+  SIMPLE_LIST_CALL;
+
+  std::mutex requests_mutex;
+  Aws::Vector<Aws::String> part_1_ranges;
+  EXPECT_GETOBJECT.WillRepeatedly(Invoke([&](const GetObjectRequest &request) {
+    if (request.GetKey() == key_1) {
+      std::lock_guard<std::mutex> lock(requests_mutex);
+      part_1_ranges.push_back(request.GetRange());
+    }
+    return MakeRangedGetObjectOutcome(
+        request.GetKey() == key_0 ? body_0 : body_1, request);
+  }));
+
+  ReadConfig config;
+  config.streaming_reads_ = 2;
+  config.part_prefetch_distance_ = 50;
+  config.stripe_size_ = 0;
+  config.random_min_fetch_ = 0;
+  test_setReadConfig(config);
+
+  void *stream = driver_fopen(pattern_, 'r');
+  ASSERT_NE(stream, nullptr);
+
+  Aws::String result;
+  std::vector<char> buffer(20);
+  long long read = 0;
+  while ((read = driver_fread(buffer.data(), 1, buffer.size(), stream)) > 0) {
+    result.append(buffer.data(), static_cast<size_t>(read));
+    if (result.size() == expected.size()) {
+      break;
+    }
+  }
+  ASSERT_EQ(result, expected);
+
+  // after the header probe, the second part is streamed once, from the end of
+  // its header
+  const Aws::Vector<Aws::String> expected_ranges{
+      "bytes=0-" + std::to_string(body_1.size() - 1),
+      "bytes=" + std::to_string(header.size()) + "-" +
+          std::to_string(body_1.size() - 1)};
+  ASSERT_EQ(part_1_ranges, expected_ranges);
+
+  ASSERT_EQ(driver_fclose(stream), kCloseSuccess);
+}
+
+TEST_F(S3DriverTestFixture, Read_SmallParts_WholePartBlocks_OK) {
+  const Aws::String header = "header\n";
+  Aws::Vector<Aws::String> keys;
+  Aws::Vector<Aws::String> bodies;
+  Aws::Vector<long long> sizes;
+  Aws::String expected = header;
+  for (char c = '0'; c <= '7'; c++) {
+    Aws::String content;
+    for (int i = 0; i < 20; i++) {
+      content += std::to_string((c - '0') * 100 + i) + ';';
+    }
+    keys.push_back(MakeKeyFromPatternStub(c));
+    bodies.push_back(header + content);
+    sizes.push_back(static_cast<long long>(bodies.back().size()));
+    expected += content;
+  }
+
+  auto content = MakeObjectVector(Aws::Vector<Aws::String>(keys),
+                                  Aws::Vector<long long>(sizes));
+  Aws::String token;
+  SIMPLE_LIST_CALL;
+
+  std::mutex requests_mutex;
+  Aws::Map<Aws::String, Aws::Vector<Aws::String>> data_ranges;
+  EXPECT_GETOBJECT.WillRepeatedly(Invoke([&](const GetObjectRequest &request) {
+    const size_t index = static_cast<size_t>(
+        std::find(keys.begin(), keys.end(), request.GetKey()) - keys.begin());
+    {
+      // skip the header probes, which all start at 0
+      std::lock_guard<std::mutex> lock(requests_mutex);
+      if (request.GetRange().compare(0, 8, "bytes=0-") != 0) {
+        data_ranges[request.GetKey()].push_back(request.GetRange());
+      }
+    }
+    return MakeRangedGetObjectOutcome(bodies[index], request);
+  }));
+
+  ReadConfig config;
+  config.sequential_reads_to_trigger_ = 1;
+  config.block_size_ = 128;
+  config.small_part_size_ = 1024;
+  config.stripe_size_ = 0;
+  config.cache_size_ = 0;
+  test_setReadConfig(config);
+
+  void *stream = driver_fopen(pattern_, 'r');
+  ASSERT_NE(stream, nullptr);
+
+  Aws::String result;
+  std::vector<char> buffer(30);
+  long long read = 0;
+  while ((read = driver_fread(buffer.data(), 1, buffer.size(), stream)) > 0) {
+    result.append(buffer.data(), static_cast<size_t>(read));
+    if (result.size() == expected.size()) {
+      break;
+    }
+  }
+  ASSERT_EQ(result, expected);
+
+  // each part after the first is downloaded whole, in a single request
+  // skipping its header
+  ASSERT_EQ(data_ranges.size(), keys.size() - 1);
+  for (size_t i = 1; i < keys.size(); i++) {
+    const Aws::Vector<Aws::String> expected_ranges{
+        "bytes=" + std::to_string(header.size()) + "-" +
+        std::to_string(bodies[i].size() - 1)};
+    ASSERT_EQ(data_ranges[keys[i]], expected_ranges);
+  }
+
+  ASSERT_EQ(driver_fclose(stream), kCloseSuccess);
+}
+
+TEST_F(S3DriverTestFixture, Read_Random_Coalesced_OK) {
+  Aws::String body;
+  for (int i = 0; i < 1000; i++) {
+    body += std::to_string(i) + ';';
+  }
+
+  ReadConfig config;
+  config.random_min_fetch_ = 64;
+  config.random_max_fetch_ = 1024;
+  config.cache_size_ = 0;
+  config.open_fetch_size_ = 0;
+  test_setReadConfig(config);
+
+  EXPECT_HEADOBJECT
+  HEADOBJECT_CALL(static_cast<long long>(body.size()));
+
+  Aws::Vector<Aws::String> ranges;
+  EXPECT_GETOBJECT.Times(2).WillRepeatedly(
+      Invoke([&](const GetObjectRequest &request) {
+        ranges.push_back(request.GetRange());
+        return MakeRangedGetObjectOutcome(body, request);
+      }));
+
+  void *stream = driver_fopen(one_file_, 'r');
+  ASSERT_NE(stream, nullptr);
+
+  // the second read is served by the window of the first one, the third is
+  // close to it, the window grows
+  std::vector<char> buffer(5);
+  for (long long offset : {100, 130, 170, 250}) {
+    ASSERT_EQ(driver_fseek(stream, offset, std::ios::beg), 0);
+    ASSERT_EQ(driver_fread(buffer.data(), 1, buffer.size(), stream), 5);
+    ASSERT_EQ(Aws::String(buffer.data(), buffer.size()),
+              body.substr(static_cast<size_t>(offset), buffer.size()));
+  }
+
+  const Aws::Vector<Aws::String> expected_ranges{"bytes=100-163",
+                                                 "bytes=170-297"};
+  ASSERT_EQ(ranges, expected_ranges);
+  ASSERT_EQ(driver_fclose(stream), kCloseSuccess);
+}
+
+TEST_F(S3DriverTestFixture, Read_Striped_MultiMatch_OK) {
+  const Aws::String key_0 = MakeKeyFromPatternStub('0');
+  const Aws::String key_1 = MakeKeyFromPatternStub('1');
+
+  const Aws::String header = "header\n";
+  const Aws::String content0 = "first part content, long enough for stripes";
+  const Aws::String content1 = "second part content, also split in stripes";
+
+  const Aws::String body_0 = header + content0;
+  const Aws::String body_1 = header + content1;
+  const Aws::String expected = body_0 + content1;
+
+  auto content =
+      MakeObjectVector({key_0, key_1}, {static_cast<long long>(body_0.size()),
+                                        static_cast<long long>(body_1.size())});
+  Aws::String token;
+  SIMPLE_LIST_CALL;
+
+  EXPECT_GETOBJECT.WillRepeatedly(Invoke([&](const GetObjectRequest &request) {
+    return MakeRangedGetObjectOutcome(
+        request.GetKey() == key_0 ? body_0 : body_1, request);
+  }));
+
+  ReadConfig config;
+  config.stripe_size_ = 10;
+  config.window_blocks_ = 0;
+  test_setReadConfig(config);
+
+  void *stream = driver_fopen(pattern_, 'r');
+  ASSERT_NE(stream, nullptr);
+
+  // a single read across both parts, more than requested is available
+  std::vector<char> buffer(expected.size() + 10);
+  ASSERT_EQ(driver_fread(buffer.data(), 1, buffer.size(), stream),
+            static_cast<long long>(expected.size()));
+  ASSERT_EQ(Aws::String(buffer.data(), expected.size()), expected);
+
+  ASSERT_EQ(driver_fclose(stream), kCloseSuccess);
+}
+
+TEST_F(S3DriverTestFixture, Read_LazyOpen_MultiMatch_OK) {
+  const Aws::String key_0 = MakeKeyFromPatternStub('0');
+  const Aws::String key_1 = MakeKeyFromPatternStub('1');
+
+  const Aws::String header = "header\n";
+  const Aws::String content0 = "first part content";
+  const Aws::String content1 = "second part content";
+
+  const Aws::String body_0 = header + content0;
+  const Aws::String body_1 = header + content1;
+  const Aws::String expected = body_0 + content1;
+
+  auto content =
+      MakeObjectVector({key_0, key_1}, {static_cast<long long>(body_0.size()),
+                                        static_cast<long long>(body_1.size())});
+  Aws::String token;
+  SIMPLE_LIST_CALL;
+
+  EXPECT_GETOBJECT.WillRepeatedly(Invoke([&](const GetObjectRequest &request) {
+    return MakeRangedGetObjectOutcome(
+        request.GetKey() == key_0 ? body_0 : body_1, request);
+  }));
+
+  ReadConfig config;
+  config.lazy_open_ = true;
+  config.window_blocks_ = 0;
+  test_setReadConfig(config);
+
+  void *stream = driver_fopen(pattern_, 'r');
+  ASSERT_NE(stream, nullptr);
+
+  // the first part is readable before the headers are checked
+  std::vector<char> buffer(expected.size() + 10);
+  ASSERT_EQ(driver_fread(buffer.data(), 1, header.size(), stream),
+            static_cast<long long>(header.size()));
+  ASSERT_EQ(Aws::String(buffer.data(), header.size()), header);
+
+  // reading further waits for the check, the repeated header is skipped
+  const long long remaining =
+      static_cast<long long>(expected.size() - header.size());
+  ASSERT_EQ(driver_fread(buffer.data(), 1, buffer.size(), stream), remaining);
+  ASSERT_EQ(Aws::String(buffer.data(), static_cast<size_t>(remaining)),
+            expected.substr(header.size()));
+
+  ASSERT_EQ(driver_fseek(stream, 0, std::ios::end), 0);
+  ASSERT_EQ(driver_fclose(stream), kCloseSuccess);
+}
+
+TEST_F(S3DriverTestFixture, Read_SharedLayout_MultiMatch_OK) {
+  const Aws::String key_0 = MakeKeyFromPatternStub('0');
+  const Aws::String key_1 = MakeKeyFromPatternStub('1');
+
+  const Aws::String header = "header\n";
+  const Aws::String body_0 = header + "first part content";
+  const Aws::String body_1 = header + "second part content";
+  const Aws::String expected = body_0 + body_1.substr(header.size());
+
+  // without the metadata caches, each open lists the files again
+  ReadConfig config;
+  config.metadata_ttl_ms_ = 0;
+  config.window_blocks_ = 0;
+  test_setReadConfig(config);
+
+  const Aws::Vector<long long> sizes{static_cast<long long>(body_0.size()),
+                                     static_cast<long long>(body_1.size())};
+  EXPECT_LISTOBJECT.Times(2).WillRepeatedly(Invoke([&](const ListObjectsV2Request &) {
+    return MakeListObjectOutcome(MakeObjectVector({key_0, key_1}, Aws::Vector<long long>(sizes)), "");
+  }));
+
+  // the headers are only probed by the first open
+  std::atomic<int> get_count{0};
+  EXPECT_GETOBJECT.WillRepeatedly(Invoke([&](const GetObjectRequest &request) {
+    get_count++;
+    return MakeRangedGetObjectOutcome(
+        request.GetKey() == key_0 ? body_0 : body_1, request);
+  }));
+
+  void *first = driver_fopen(pattern_, 'r');
+  ASSERT_NE(first, nullptr);
+  const int probes = get_count.load();
+  ASSERT_GT(probes, 0);
+
+  void *second = driver_fopen(pattern_, 'r');
+  ASSERT_NE(second, nullptr);
+  ASSERT_EQ(get_count.load(), probes);
+  ASSERT_EQ(static_cast<Reader *>(first)->layout_,
+            static_cast<Reader *>(second)->layout_);
+
+  // each handle has its own position
+  std::vector<char> buffer(expected.size());
+  ASSERT_EQ(driver_fread(buffer.data(), 1, buffer.size(), first),
+            static_cast<long long>(expected.size()));
+  ASSERT_EQ(Aws::String(buffer.data(), buffer.size()), expected);
+  ASSERT_EQ(driver_fread(buffer.data(), 1, header.size(), second),
+            static_cast<long long>(header.size()));
+  ASSERT_EQ(Aws::String(buffer.data(), header.size()), header);
+
+  ASSERT_EQ(driver_fclose(first), kCloseSuccess);
+  ASSERT_EQ(driver_fclose(second), kCloseSuccess);
+}
+
+TEST_F(S3DriverTestFixture, Read_ManyParts_CompactListing_OK) {
+  // enough parts for the names to be stored as suffixes of several full names,
+  // with versions of each kind: MD5, multipart upload and unknown
+  const size_t part_count = 40;
+  const Aws::String header = "header\n";
+  Aws::Vector<Aws::String> keys;
+  Aws::Vector<long long> sizes;
+  Aws::Map<Aws::String, Aws::String> bodies;
+  Aws::Map<Aws::String, Aws::String> etags;
+  Aws::String expected = header;
+  for (size_t i = 0; i < part_count; i++) {
+    Aws::String key = MakeKeyFromPatternStub('_');
+    key += std::to_string(1000 + i * 7);
+    const Aws::String content = "content of part " + std::to_string(i) + '\n';
+    bodies[key] = header + content;
+    expected += content;
+    Aws::String md5(32, static_cast<char>('a' + i % 6));
+    md5[0] = static_cast<char>('0' + i % 10);
+    etags[key] = i % 3 == 0   ? '"' + md5 + '"'
+                 : i % 3 == 1 ? '"' + md5 + "-2\""
+                              : "";
+    keys.push_back(key);
+    sizes.push_back(static_cast<long long>(bodies[key].size()));
+  }
+
+  auto content = MakeObjectVector(Aws::Vector<Aws::String>(keys),
+                                  Aws::Vector<long long>(sizes));
+  for (auto &object : content) {
+    object.SetETag(etags[object.GetKey()]);
+  }
+  Aws::String token;
+  SIMPLE_LIST_CALL;
+
+  // every request names a listed part and its version
+  EXPECT_GETOBJECT.WillRepeatedly(Invoke([&](const GetObjectRequest &request) {
+    const auto body = bodies.find(request.GetKey());
+    EXPECT_NE(body, bodies.end());
+    EXPECT_EQ(request.GetIfMatch(), etags[request.GetKey()]);
+    return MakeRangedGetObjectOutcome(
+        body == bodies.end() ? Aws::String() : body->second, request);
+  }));
+
+  ReadConfig config;
+  config.window_blocks_ = 0;
+  test_setReadConfig(config);
+
+  void *stream = driver_fopen(pattern_, 'r');
+  ASSERT_NE(stream, nullptr);
+
+  std::vector<char> buffer(expected.size());
+  ASSERT_EQ(driver_fread(buffer.data(), 1, buffer.size(), stream),
+            static_cast<long long>(expected.size()));
+  ASSERT_EQ(Aws::String(buffer.data(), buffer.size()), expected);
+
+  ASSERT_EQ(driver_fclose(stream), kCloseSuccess);
+}
+
+TEST_F(S3DriverTestFixture, Read_BlockCache_SharedByHandles_OK) {
+  Aws::String body;
+  for (int i = 0; i < 100; i++) {
+    body += std::to_string(i) + ';';
+  }
+  const long long body_size = static_cast<long long>(body.size());
+
+  ReadConfig config;
+  config.window_blocks_ = 0;
+  config.stripe_size_ = 0;
+  config.cache_block_size_ = 16;
+  config.random_min_fetch_ = 0;
+  config.open_fetch_size_ = 0;
+  test_setReadConfig(config);
+
+  // the second handle gets the metadata from the cache
+  EXPECT_HEADOBJECT
+  HEADOBJECT_CALL_ETAG(body_size, "\"v1\"");
+
+  // only the first handle downloads: a small range, then the missing blocks
+  // before and after it
+  EXPECT_GETOBJECT.Times(3).WillRepeatedly(
+      Invoke([&](const GetObjectRequest &request) {
+        return MakeRangedGetObjectOutcome(body, request);
+      }));
+
+  std::vector<char> buffer(body.size());
+
+  void *first = driver_fopen(one_file_, 'r');
+  ASSERT_NE(first, nullptr);
+  ASSERT_EQ(driver_fseek(first, 20, std::ios::beg), 0);
+  ASSERT_EQ(driver_fread(buffer.data(), 1, 5, first), 5);
+  ASSERT_EQ(driver_fseek(first, 0, std::ios::beg), 0);
+  ASSERT_EQ(driver_fread(buffer.data(), 1, buffer.size(), first), body_size);
+  ASSERT_EQ(Aws::String(buffer.data(), buffer.size()), body);
+  ASSERT_EQ(driver_fclose(first), kCloseSuccess);
+
+  void *second = driver_fopen(one_file_, 'r');
+  ASSERT_NE(second, nullptr);
+  std::fill(buffer.begin(), buffer.end(), '\0');
+  ASSERT_EQ(driver_fread(buffer.data(), 1, buffer.size(), second), body_size);
+  ASSERT_EQ(Aws::String(buffer.data(), buffer.size()), body);
+  ASSERT_EQ(driver_fclose(second), kCloseSuccess);
+}
+
+TEST_F(S3DriverTestFixture, Read_ZeroCopy_SeveralSegments_OK) {
+  Aws::String body;
+  for (int i = 0; i < 100; i++) {
+    body += std::to_string(i) + ';';
+  }
+  const long long body_size = static_cast<long long>(body.size());
+
+  ReadConfig config;
+  config.window_blocks_ = 0;
+  config.stripe_size_ = 0;
+  config.cache_block_size_ = 16;
+  config.random_min_fetch_ = 0;
+  config.open_fetch_size_ = 0;
+  test_setReadConfig(config);
+
+  EXPECT_HEADOBJECT
+  HEADOBJECT_CALL_ETAG(body_size, "\"v1\"");
+
+  // one request fills all the blocks, the last one partly, and what was
+  // written can be read back across them
+  Aws::String read_back;
+  EXPECT_GETOBJECT.WillOnce(Invoke([&](const GetObjectRequest &request) {
+    auto outcome = MakeFactoryGetObjectOutcome(body, request);
+    Aws::StringStream content;
+    content << outcome.GetResult().GetBody().rdbuf();
+    read_back = content.str();
+    return outcome;
+  }));
+
+  void *stream = driver_fopen(one_file_, 'r');
+  ASSERT_NE(stream, nullptr);
+
+  std::vector<char> buffer(body.size());
+  ASSERT_EQ(driver_fread(buffer.data(), 1, buffer.size(), stream), body_size);
+  ASSERT_EQ(Aws::String(buffer.data(), buffer.size()), body);
+  ASSERT_EQ(read_back, body);
+
+  ASSERT_EQ(driver_fclose(stream), kCloseSuccess);
+}
+
+TEST_F(S3DriverTestFixture, Read_ZeroCopy_BodyOverflow_Failure) {
+  Aws::String body;
+  for (int i = 0; i < 100; i++) {
+    body += std::to_string(i) + ';';
+  }
+  const long long body_size = static_cast<long long>(body.size());
+
+  ReadConfig config;
+  config.window_blocks_ = 0;
+  config.stripe_size_ = 0;
+  config.cache_block_size_ = 16;
+  config.random_min_fetch_ = 0;
+  config.open_fetch_size_ = 0;
+  test_setReadConfig(config);
+
+  EXPECT_HEADOBJECT
+  HEADOBJECT_CALL_ETAG(body_size, "\"v1\"");
+
+  // the response is longer than the two blocks it should fill
+  EXPECT_GETOBJECT.WillOnce(Invoke([&](const GetObjectRequest &request) {
+    GetObjectResult res;
+    res.ReplaceBody(SendResponseBody(
+        request, Aws::Http::HttpResponseCode::PARTIAL_CONTENT,
+        body.substr(16, 48)));
+    return GetObjectOutcome(std::move(res));
+  }));
+
+  void *stream = driver_fopen(one_file_, 'r');
+  ASSERT_NE(stream, nullptr);
+
+  std::vector<char> buffer(32);
+  ASSERT_EQ(driver_fseek(stream, 16, std::ios::beg), 0);
+  ASSERT_EQ(driver_fread(buffer.data(), 1, buffer.size(), stream), kBadSize);
+
+  ASSERT_EQ(driver_fclose(stream), kCloseSuccess);
+}
+
+TEST_F(S3DriverTestFixture, Read_DiskCache_BoundedAndSuperseded_OK) {
+  Aws::String body;
+  for (int i = 0; i < 16; i++) {
+    body += "abc" + std::to_string(i % 10);
+  }
+  const long long body_size = static_cast<long long>(body.size());
+
+  std::ostringstream cache_dir;
+  cache_dir << "s3_cache_" << boost::uuids::random_generator()();
+
+  // a block file holds its key, "bucket\0name\0\"vN\"\0index", and 16 bytes
+  const size_t file_size = 2 * sizeof(uint64_t) + 18 + 16;
+  ReadConfig config;
+  config.window_blocks_ = 0;
+  config.stripe_size_ = 0;
+  config.cache_size_ = 0;
+  config.cache_block_size_ = 16;
+  config.cache_dir_ = cache_dir.str();
+  config.cache_dir_size_ = 2 * file_size;
+  config.random_min_fetch_ = 0;
+  config.open_fetch_size_ = 0;
+  config.metadata_ttl_ms_ = 0;
+  test_setReadConfig(config);
+
+  EXPECT_HEADOBJECT.WillOnce(Return(MakeHeadObjectOutcome(body_size, "\"v1\"")))
+      .WillOnce(Return(MakeHeadObjectOutcome(body_size, "\"v1\"")))
+      .WillOnce(Return(MakeHeadObjectOutcome(body_size, "\"v2\"")));
+  EXPECT_GETOBJECT.Times(3).WillRepeatedly(
+      Invoke([&](const GetObjectRequest &request) {
+        return MakeRangedGetObjectOutcome(body, request);
+      }));
+  std::vector<char> buffer(body.size());
+
+  // only the last two blocks stay on disk
+  void *stream = driver_fopen(one_file_, 'r');
+  ASSERT_NE(stream, nullptr);
+  ASSERT_EQ(driver_fread(buffer.data(), 1, buffer.size(), stream), body_size);
+  ASSERT_EQ(driver_fclose(stream), kCloseSuccess);
+  ASSERT_EQ(test_getDiskCacheUsage(), 2 * file_size);
+
+  stream = driver_fopen(one_file_, 'r');
+  ASSERT_NE(stream, nullptr);
+  ASSERT_EQ(driver_fseek(stream, 48, std::ios::beg), 0);
+  ASSERT_EQ(driver_fread(buffer.data(), 1, 16, stream), 16);
+  ASSERT_EQ(Aws::String(buffer.data(), 16), body.substr(48, 16));
+  ASSERT_EQ(driver_fseek(stream, 0, std::ios::beg), 0);
+  ASSERT_EQ(driver_fread(buffer.data(), 1, 16, stream), 16);
+  ASSERT_EQ(Aws::String(buffer.data(), 16), body.substr(0, 16));
+  ASSERT_EQ(driver_fclose(stream), kCloseSuccess);
+
+  // the blocks of the previous version are removed
+  stream = driver_fopen(one_file_, 'r');
+  ASSERT_NE(stream, nullptr);
+  ASSERT_EQ(driver_fread(buffer.data(), 1, 16, stream), 16);
+  ASSERT_EQ(driver_fclose(stream), kCloseSuccess);
+  ASSERT_EQ(test_getDiskCacheUsage(), file_size);
+
+  // without any room, the files are removed when the cache is indexed
+  config.cache_dir_size_ = 0;
+  test_setReadConfig(config);
+  ASSERT_EQ(test_getDiskCacheUsage(), 0u);
+  ASSERT_EQ(std::remove(cache_dir.str().c_str()), 0);
+}
+
+TEST_F(S3DriverTestFixture, Read_DiskCache_SharedDirectory_OK) {
+  Aws::String body;
+  for (int i = 0; i < 8; i++) {
+    body += "abc" + std::to_string(i % 10);
+  }
+  const long long body_size = static_cast<long long>(body.size());
+
+  std::ostringstream cache_dir;
+  cache_dir << "s3_cache_" << boost::uuids::random_generator()();
+
+  const size_t file_size = 2 * sizeof(uint64_t) + 18 + 16;
+  ReadConfig config;
+  config.window_blocks_ = 0;
+  config.stripe_size_ = 0;
+  config.cache_size_ = 0;
+  config.cache_block_size_ = 16;
+  config.cache_dir_ = cache_dir.str();
+  config.cache_dir_size_ = 2 * file_size;
+  config.random_min_fetch_ = 0;
+  config.open_fetch_size_ = 0;
+  test_setReadConfig(config);
+
+  // a block stored by another process counts in the budget, it is measured
+  // without being read
+  const std::string foreign_path = cache_dir.str() + "/foreign-0.blk";
+  {
+    std::ofstream foreign(foreign_path, std::ios::binary);
+    foreign << std::string(file_size, 'x');
+  }
+  test_setReadConfig(config);
+  ASSERT_EQ(test_getDiskCacheUsage(), file_size);
+
+  EXPECT_HEADOBJECT
+  HEADOBJECT_CALL_ETAG(body_size, "\"v1\"");
+  EXPECT_GETOBJECT.WillOnce(Invoke([&](const GetObjectRequest &request) {
+    return MakeRangedGetObjectOutcome(body, request);
+  }));
+
+  // the blocks stored make it the least recently used file of the directory
+  void *stream = driver_fopen(one_file_, 'r');
+  ASSERT_NE(stream, nullptr);
+  std::vector<char> buffer(body.size());
+  ASSERT_EQ(driver_fread(buffer.data(), 1, buffer.size(), stream), body_size);
+  ASSERT_EQ(driver_fclose(stream), kCloseSuccess);
+  ASSERT_EQ(test_getDiskCacheUsage(), 2 * file_size);
+  ASSERT_FALSE(std::ifstream(foreign_path).is_open());
+
+  config.cache_dir_size_ = 0;
+  test_setReadConfig(config);
+  ASSERT_EQ(test_getDiskCacheUsage(), 0u);
+  ASSERT_EQ(std::remove(cache_dir.str().c_str()), 0);
+}
+
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
 
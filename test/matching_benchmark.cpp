@@ -0,0 +1,86 @@
+// Compares the compiled glob matcher with gitignore_glob_match on the keys of a
+// large generated listing. Usage: matching_benchmark [key_count]
+#include "contrib/matching.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Keys of a bucket with several datasets split in many parts, and the other
+// files found next to them
+std::vector<std::string> MakeKeys(size_t key_count) {
+  const std::vector<std::string> datasets = {"adult", "census", "iris",
+                                             "mushroom"};
+  std::vector<std::string> keys;
+  keys.reserve(key_count);
+  for (size_t i = 0; keys.size() < key_count; i++) {
+    const std::string &dataset = datasets[i % datasets.size()];
+    std::string number = std::to_string(i / datasets.size());
+    number.insert(0, number.size() < 6 ? 6 - number.size() : 0, '0');
+    const std::string dir = "data/" + dataset + "/";
+    switch (i % 5) {
+    case 0:
+      keys.push_back(dir + "part-" + number + ".txt");
+      break;
+    case 1:
+      keys.push_back(dir + "part-" + number + ".csv");
+      break;
+    case 2:
+      keys.push_back(dir + "tmp/part-" + number + ".txt");
+      break;
+    case 3:
+      keys.push_back(dir + "part-" + number + ".txt.crc");
+      break;
+    default:
+      keys.push_back(dir + "_logs/" + number + ".log");
+      break;
+    }
+  }
+  return keys;
+}
+
+template <typename Match>
+void Run(const char *name, const std::vector<std::string> &keys,
+         Match match) {
+  const auto start = std::chrono::steady_clock::now();
+  size_t matched = 0;
+  for (const auto &key : keys) {
+    matched += match(key) ? 1 : 0;
+  }
+  const std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::cout << "  " << std::left << std::setw(10) << name << std::right
+            << std::setw(10) << std::fixed << std::setprecision(1)
+            << elapsed.count() << " ms, " << matched << " matches\n";
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  const size_t key_count =
+      argc > 1 ? static_cast<size_t>(std::strtoull(argv[1], nullptr, 10))
+               : 1000000;
+  const std::vector<std::string> keys = MakeKeys(key_count);
+
+  const std::vector<std::string> patterns = {
+      "data/adult/part-*.txt",     "data/*/part-0001??.txt",
+      "data/census/part-[0-4]*.*", "data/iris/*",
+      "data/**/part-*.txt",        "part-*.csv"};
+
+  std::cout << keys.size() << " keys\n";
+  for (const auto &pattern : patterns) {
+    std::cout << pattern << '\n';
+    Run("reference", keys, [&](const std::string &key) {
+      return utils::gitignore_glob_match(key, pattern);
+    });
+    const utils::GlobMatcher matcher{pattern};
+    Run("compiled", keys,
+        [&](const std::string &key) { return matcher.Match(key); });
+  }
+  return 0;
+}